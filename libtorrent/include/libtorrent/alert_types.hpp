@@ -579,6 +579,28 @@ namespace libtorrent
 		int piece_index;
 	};
 
+	// [MF] posted (regardless of the alert mask) when a piece is
+	// marked as not available by we_dont_have(), so the application
+	// can drop anything it derived from it. never discarded, even
+	// when the alert queue is full: a lost one would leave stale data.
+	struct TORRENT_EXPORT piece_dropped_alert: torrent_alert
+	{
+		piece_dropped_alert(
+			const torrent_handle& h
+			, int piece_num)
+			: torrent_alert(h)
+			, piece_index(piece_num)
+		{ TORRENT_ASSERT(piece_index >= 0);}
+
+		TORRENT_DEFINE_ALERT(piece_dropped_alert);
+
+		const static int static_category = alert::storage_notification;
+		virtual std::string message() const;
+		virtual bool discardable() const { return false; }
+
+		int piece_index;
+	};
+
 	struct TORRENT_EXPORT request_dropped_alert: peer_alert
 	{
 		request_dropped_alert(const torrent_handle& h, tcp::endpoint const& ep
@@ -65,6 +65,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdlib.h>
 #include <string>
+#include <string.h> // for strlen
 #include <exception>
 #include <iterator> // for distance
 
@@ -410,6 +411,54 @@ namespace libtorrent
 		if (err) return entry();
 		return e;
 	}
+
+	// [MF] streaming bencoder. Appends straight to a caller owned (and
+	// reusable) container without building an entry tree first.
+	// Dictionary keys must be written in sorted order by the caller.
+	template <class Container>
+	struct bencode_writer
+	{
+		bencode_writer(Container& c) : m_out(c) {}
+
+		void begin_dict() { m_out.push_back('d'); }
+		void begin_list() { m_out.push_back('l'); }
+		void end() { m_out.push_back('e'); }
+
+		void key(char const* k) { string(k, int(strlen(k))); }
+
+		void string(char const* s, int len)
+		{
+			length_prefix(len);
+			m_out.insert(m_out.end(), s, s + len);
+		}
+		void string(std::string const& s) { string(s.data(), int(s.size())); }
+
+		// start a string of len bytes, to be filled with raw()
+		void length_prefix(int len)
+		{
+			char buf[21];
+			char const* str = detail::integer_to_str(buf, 21, len);
+			m_out.insert(m_out.end(), str, str + strlen(str));
+			m_out.push_back(':');
+		}
+
+		void integer(entry::integer_type val)
+		{
+			char buf[21];
+			char const* str = detail::integer_to_str(buf, 21, val);
+			m_out.push_back('i');
+			m_out.insert(m_out.end(), str, str + strlen(str));
+			m_out.push_back('e');
+		}
+
+		// data that is already bencoded (or the body of a string
+		// started with length_prefix), copied as is
+		void raw(char const* s, int len) { m_out.insert(m_out.end(), s, s + len); }
+		void raw(std::string const& s) { raw(s.data(), int(s.size())); }
+
+	private:
+		Container& m_out;
+	};
 }
 
 #endif // TORRENT_BENCODE_HPP_INCLUDED
@@ -224,6 +224,8 @@ POSSIBILITY OF SUCH DAMAGE.
  #define TORRENT_USE_IFADDRS 0
 #else
  #define TORRENT_USE_IFADDRS 1
+ // [MF] recvmmsg/sendmmsg (glibc >= 2.14)
+ #define TORRENT_USE_MMSG 1
 #endif
 #define TORRENT_USE_NETLINK 1
 #define TORRENT_USE_IFCONF 1
@@ -471,6 +473,10 @@ inline int snprintf(char* buf, int len, char const* fmt, ...)
 #define TORRENT_USE_IFADDRS 0
 #endif
 
+#ifndef TORRENT_USE_MMSG
+#define TORRENT_USE_MMSG 0
+#endif
+
 #ifndef TORRENT_USE_IPV6
 #define TORRENT_USE_IPV6 1
 #endif
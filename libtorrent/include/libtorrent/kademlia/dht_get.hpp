@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <vector>
 #include <map>
+#include <set>
 
 #include <libtorrent/kademlia/traversal_algorithm.hpp>
 #include <libtorrent/kademlia/node_id.hpp>
@@ -74,15 +75,23 @@ public:
 		, std::string const &targetUser, std::string const &targetResource, bool multi
 		, data_callback const& dcallback
 		, nodes_callback const& ncallback
-		, bool justToken, bool dontDrop );
+		, bool justToken, bool dontDrop
+		, std::vector<node_entry> const* nodes = NULL );
 
 	virtual char const* name() const { return "getData"; }
 
 	node_id const target() const { return traversal_algorithm::target(); }
 
+	// [MF] complete as soon as the replies agree (see dht_settings::get_quorum)
+	// instead of waiting for the whole traversal. only for plain lookups: the
+	// tokens of all k closest nodes are needed to store or refresh an item.
+	void allow_early_completion();
+
 protected:
 
 	void done();
+	bool replies_agree(entry::list_type const& values_list);
+	void report_nodes();
 	observer_ptr new_observer(void* ptr, udp::endpoint const& ep, node_id const& id);
 	virtual bool invoke(observer_ptr o);
 
@@ -99,6 +108,15 @@ private:
 	bool m_got_data:1;
 	bool m_justToken:1;
 	bool m_dontDrop:1;
+	bool m_early:1;
+	// [MF] only query the given nodes, no traversal (refresh planner)
+	bool m_fixed:1;
+
+	// state of early completion
+	boost::int64_t m_best_seq;
+	int m_seq_agree;
+	int m_stale_replies;
+	std::set<std::string> m_sig_ps;
 
 	friend class dht_get_observer;
 };
@@ -126,6 +126,8 @@ namespace libtorrent { namespace dht
 
 		// implements udp_socket_interface
 		virtual bool send_packet(libtorrent::entry& e, udp::endpoint const& addr, int send_flags);
+		virtual bool send_reply(std::string const& t, char const* r, int len
+			, udp::endpoint const& addr, int send_flags);
 
 		node_impl m_dht;
 		rate_limited_udp_socket& m_sock;
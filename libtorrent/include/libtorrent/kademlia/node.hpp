@@ -36,6 +36,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <algorithm>
 #include <map>
 #include <set>
+#include <vector>
+#include <cstring> // for memcmp
 
 #include <libtorrent/config.hpp>
 #include <libtorrent/kademlia/routing_table.hpp>
@@ -52,6 +54,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/cstdint.hpp>
 #include <boost/ref.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "libtorrent/socket.hpp"
 
@@ -100,30 +103,55 @@ bool TORRENT_EXTRA_EXPORT verify_message(lazy_entry const* msg, key_desc_t const
 // this is the entry for every peer
 // the timestamp is there to make it possible
 // to remove stale peers
-struct peer_entry
+// [MF] the endpoint is kept in the compact form sent in get_peers
+// replies (ip + port, network byte order): 6 bytes for v4, 18 for v6.
+template <int Size>
+struct compact_peer_entry
 {
-	tcp::endpoint addr;
+	char addr[Size];
 	ptime added;
 	bool seed;
+
+	bool same_endpoint(char const* a) const
+	{ return std::memcmp(addr, a, Size) == 0; }
+};
+
+// orders peer entries by endpoint, for binary searches by compact endpoint
+struct compact_endpoint_less
+{
+	template <int Size>
+	bool operator()(compact_peer_entry<Size> const& p, char const* a) const
+	{ return std::memcmp(p.addr, a, Size) < 0; }
 };
 
+typedef compact_peer_entry<6> peer_entry_v4;
+typedef compact_peer_entry<18> peer_entry_v6;
+
 // this is a group. It contains a set of group members
+// [MF] peers are kept in flat vectors sorted by endpoint: announces
+// find their entry with a binary search and lookups sample random
+// indices.
 struct torrent_entry
 {
+	torrent_entry() : list_peers(0) {}
+
 	std::string name;
-	std::set<peer_entry> peers;
+	std::vector<peer_entry_v4> peers4;
+	std::vector<peer_entry_v6> peers6;
 	int list_peers; // number of known peers (copied from torrent status)
+
+	int num_peers() const { return int(peers4.size() + peers6.size()); }
 };
 
 struct dht_storage_item
 {
     // FIXME: optimize so bdecode is not needed all the time
-    dht_storage_item() : p(), sig_p(), sig_user(), local_add_time(0), confirmed(true), next_refresh_time() {}
+    dht_storage_item() : p(), sig_p(), sig_user(), local_add_time(0), confirmed(true), next_refresh_time(), sig_checked(true) {}
     dht_storage_item(std::string const &_p, lazy_entry const *_sig_p, lazy_entry const *_sig_user)
         : p(_p), sig_p(_sig_p->string_value()), sig_user(_sig_user->string_value()),
-          local_add_time(0), confirmed(true), next_refresh_time() {}
+          local_add_time(0), confirmed(true), next_refresh_time(), sig_checked(true) {}
     dht_storage_item(std::string const &_p, std::string const &_sig_p, std::string const &_sig_user)
-        : p(_p), sig_p(_sig_p), sig_user(_sig_user), local_add_time(0), confirmed(true), next_refresh_time() {}
+        : p(_p), sig_p(_sig_p), sig_user(_sig_user), local_add_time(0), confirmed(true), next_refresh_time(), sig_checked(true) {}
         std::string p;
         std::string sig_p;
         std::string sig_user;
@@ -132,16 +160,26 @@ struct dht_storage_item
         //ptime last_seen;
         bool confirmed;
         ptime next_refresh_time;
+        // [MF] items loaded from disk were checked when first stored, their
+        // signature is checked again only when they are first refreshed.
+        bool sig_checked;
 };
 
-
-// internal
-inline bool operator<(peer_entry const& lhs, peer_entry const& rhs)
+// [MF] an item due for refresh, waiting in the refresh planner
+struct refresh_job
 {
-	return lhs.addr.address() == rhs.addr.address()
-		? lhs.addr.port() < rhs.addr.port()
-		: lhs.addr.address() < rhs.addr.address();
-}
+	std::string username;
+	std::string resource;
+	bool multi;
+	entry p;
+	std::string sig_p;
+	std::string sig_user;
+	bool confirmed;
+	bool dont_drop;
+	// rough number of bytes its lookup and stores will send
+	int cost;
+};
+
 
 struct null_type {};
 
@@ -163,13 +201,16 @@ struct count_peers
 	void operator()(std::pair<libtorrent::dht::node_id
 		, libtorrent::dht::torrent_entry> const& t)
 	{
-		count += t.second.peers.size();
+		count += t.second.num_peers();
 	}
 };
 
 struct udp_socket_interface
 {
 	virtual bool send_packet(entry& e, udp::endpoint const& addr, int flags) = 0;
+	// [MF] send a reply whose "r" dictionary is already bencoded
+	virtual bool send_reply(std::string const& t, char const* r, int len
+		, udp::endpoint const& addr, int flags) = 0;
 };
 
 class TORRENT_EXTRA_EXPORT node_impl : boost::noncopyable
@@ -178,6 +219,9 @@ typedef std::map<node_id, torrent_entry> table_t;
 typedef std::list<dht_storage_item> dht_storage_list_t;
 typedef std::map<node_id, dht_storage_list_t> dht_storage_table_t;
 typedef std::map< std::string, std::pair<int,int> > dht_posts_by_user_t; // total known, latest known
+// sorted by target, so items of a neighbourhood are next to each other
+typedef std::multimap<node_id, refresh_job> refresh_queue_t;
+typedef std::vector<std::pair<node_id, refresh_job> > refresh_group_t;
 
 public:
 	node_impl(alert_dispatcher* alert_disp, udp_socket_interface* sock
@@ -188,6 +232,13 @@ public:
 
 	void tick();
     bool refresh_storage();
+	void send_refresh_batch();
+	void refresh_group(std::vector<std::pair<node_entry, std::string> > const& v
+		, boost::shared_ptr<refresh_group_t> group);
+	void confirm_refresh(entry::list_type const& values_list
+		, node_id const& target, std::string const& sig_p);
+	// bytes per second the dht may send, the refresh planner uses part of it
+	void set_upload_rate_limit(int limit) { m_upload_rate_limit = limit; }
     bool has_expired(dht_storage_item const& item, bool skipSigCheck=false);
     bool save_storage(entry &save) const;
     void refresh(node_id const& id, find_data::nodes_callback const& f);
@@ -287,7 +338,7 @@ private:
 	// since it might have references to it
 	std::set<traversal_algorithm*> m_running_requests;
 
-	void incoming_request(msg const& h, entry& e);
+	bool incoming_request(msg const& h, entry& e);
 	bool store_dht_item(dht_storage_item &item, big_number const &target, 
 	                    bool multi, int seq, int height, std::pair<char const*, int> &bufv);
 	void process_newly_stored_entry(const lazy_entry &p);
@@ -306,11 +357,18 @@ private:
 	ptime m_last_tracker_tick;
 	ptime m_next_storage_refresh;
 
+	refresh_queue_t m_refresh_queue;
+	node_id m_refresh_cursor;
+	int m_upload_rate_limit;
+
 	// secret random numbers used to create write tokens
 	int m_secret[2];
 
 	alert_dispatcher* m_post_alert;
 	udp_socket_interface* m_sock;
+
+	// [MF] reused to encode getData replies
+	std::vector<char> m_reply_buf;
 };
 
 
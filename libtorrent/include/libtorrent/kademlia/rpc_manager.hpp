@@ -102,6 +102,9 @@ public:
 
 	int num_allocated_observers() const { return m_allocated_observers; }
 
+	// [MF] smoothed round trip time of replies, in milliseconds
+	int average_rtt() const { return m_rtt; }
+
 private:
 
 	boost::uint32_t calc_connection_id(udp::endpoint addr);
@@ -119,6 +122,7 @@ private:
 	int m_allocated_observers;
 	bool m_destructing;
 	dht_observer* m_observer;
+	int m_rtt;
 };
 
 } } // namespace libtorrent::dht
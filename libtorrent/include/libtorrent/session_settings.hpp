@@ -971,6 +971,14 @@ namespace libtorrent
 		// returning memory to the kernel when cache pressure
 		// is low.
 		bool use_disk_cache_pool;
+
+		// [MF] the number of seconds a torrent may spend without
+		// any peer connection before it turns dormant. dormant
+		// torrents are skipped by the session tick and don't
+		// connect to peers until an incoming connection, a local
+		// piece, new peers from the dht tracker or an explicit
+		// torrent_handle::wake_up() brings them back. 0 disables it.
+		int dormant_torrent_timeout;
 	};
 
 	// structure used to hold configuration options for the DHT
@@ -989,6 +997,7 @@ namespace libtorrent
 #endif
 			, max_fail_count(20)
 			, max_torrents(2000)
+			, max_torrent_peers(500)
 			, max_dht_items(700)
 			, max_entries_per_multi(32)
 			, max_torrent_search_reply(20)
@@ -996,6 +1005,7 @@ namespace libtorrent
 			, restrict_search_ips(true)
 			, extended_routing_table(true)
 			, aggressive_lookups(true)
+			, get_quorum(3)
 		{}
 		
 		// the maximum number of peers to send in a
@@ -1025,6 +1035,10 @@ namespace libtorrent
 		// an unbounded amount of memory.
 		int max_torrents;
 
+		// [MF] the max number of peers tracked per torrent (and address
+		// family). once reached, a new peer replaces the oldest one.
+		int max_torrent_peers;
+
 		// max number of items the DHT will store
 		int max_dht_items;
 
@@ -1064,6 +1078,12 @@ namespace libtorrent
 		// i.e. every time we get results back with closer nodes, we query them right away.
 		// It lowers the lookup times at the cost of more outstanding queries.
 		bool aggressive_lookups;
+
+		// [MF] number of responders that must agree on the newest seq of a
+		// single resource (or return no new entries of a multi resource)
+		// before a getData lookup completes without waiting for the rest
+		// of the traversal. 0 disables early completion.
+		int get_quorum;
 	};
 
 #ifndef TORRENT_DISABLE_ENCRYPTION
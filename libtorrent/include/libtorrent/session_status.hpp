@@ -184,6 +184,9 @@ namespace libtorrent
 		// the number of torrents tracked by the DHT at the moment.
 		int dht_torrents;
 
+		// [MF] the number of (signed) items held in the DHT storage table.
+		int dht_storage_items;
+
 		// an estimation of the total number of nodes in the DHT
 		// network.
 		size_type dht_global_nodes;
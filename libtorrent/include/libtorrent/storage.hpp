@@ -232,12 +232,20 @@ namespace libtorrent
 		boost::intrusive_ptr<file> open_file(file_storage::iterator fe, int mode
 			, error_code& ec) const;
 
+		// [MF] the short id standing for m_db_path in piece keys,
+		// assigned the first time the torrent is opened
+		boost::uint32_t db_user_id();
+		void migrate_db_layout();
+
 		std::vector<boost::uint8_t> m_file_priority;
 		std::string m_db_path;
 		// the leveldb is typically stored in
 		// the session, to make all storage
 		// instances use the same database
 		CLevelDB& m_db;
+		boost::uint32_t m_db_user_id;
+		// reused by readv to avoid an allocation per read
+		std::string m_db_value;
 
 		int m_page_size;
 		bool m_allocate_files;
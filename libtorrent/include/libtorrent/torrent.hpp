@@ -202,6 +202,7 @@ namespace libtorrent
 
 		void get_pieces(std::vector<std::string> *pieces, int count, int max_id, int since_id, uint32_t filter_flags,
 						mutex *mut, condition_variable *cond, int *reqs);
+		void get_piece_ids(std::vector<int> *ids, int count, int max_id, int since_id, uint32_t filter_flags);
 		void on_disk_read_get_piece_complete(int ret, disk_io_job const& j,
 											 std::vector<std::string> *pieces, mutex *mut, condition_variable *cond, int *reqs);
 
@@ -236,6 +237,9 @@ namespace libtorrent
 		int queue_position() const { return m_sequence_number; }
 
 		void second_tick(stat& accumulator, int tick_interval_ms);
+		// [MF] the activity, download and scrape timers. part of
+		// second_tick, dormant torrents only get this one
+		void update_time_counters();
 
 		std::string name() const;
 
@@ -514,6 +518,14 @@ namespace libtorrent
 		
 		void super_seeding(bool on);
 		void set_following(bool on);
+
+		// [MF] dormant torrents have no connections and no recent
+		// activity. they are not ticked and don't connect to peers,
+		// keeping just the have bitfield and the peers learned from
+		// the dht tracker until something wakes them up.
+		bool is_dormant() const { return m_dormant; }
+		void go_dormant();
+		void wake_up();
 		int get_piece_to_super_seed(bitfield const&);
 
 		// returns true if we have downloaded the given piece
@@ -1224,6 +1236,9 @@ namespace libtorrent
 		// if this is true, we're currently following this user
 		bool m_following:1;
 
+		// [MF] set by go_dormant(), cleared by wake_up()
+		bool m_dormant:1;
+
 		// this is set when we don't want to load seed_mode,
 		// paused or auto_managed from the resume data
 		bool m_override_resume_data:1;
@@ -1347,6 +1362,10 @@ namespace libtorrent
 		// one of the trackers in this torrent
 		boost::uint16_t m_last_scrape;
 
+		// the number of seconds this torrent has been without
+		// any peer connection. saturates at 0xffff
+		boost::uint16_t m_idle_time;
+
 		// the scrape data from the tracker response, this
 		// is optional and may be 0xffffff
 		unsigned int m_downloaded:24;
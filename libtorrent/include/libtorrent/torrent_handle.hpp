@@ -169,6 +169,9 @@ namespace libtorrent
 		void add_piece(int piece, char const* data, int size, int flags = 0) const;
 		void read_piece(int piece) const;
 		void get_pieces(std::vector<std::string> &pieces, int count, int max_id, int since_id, uint32_t filter_flags) const;
+		// [MF] same selection as get_pieces, but only returns the piece
+		// indexes (highest first) without reading them from storage
+		void get_piece_ids(std::vector<int> &ids, int count, int max_id, int since_id, uint32_t filter_flags) const;
 		bool have_piece(int piece) const;
 		void recheck_pieces(uint32_t piece_flags) const;
 
@@ -413,6 +416,8 @@ namespace libtorrent
 
 		void super_seeding(bool on) const;
 		void set_following(bool on) const;
+		// [MF] bring a dormant torrent back to normal operation
+		void wake_up() const;
 
 		sha1_hash info_hash() const;
 
@@ -467,6 +472,10 @@ namespace libtorrent
 		state_t state;
 		bool paused;
 		bool auto_managed;
+
+		// [MF] true if the torrent has been idle long enough to turn
+		// dormant (see session_settings::dormant_torrent_timeout)
+		bool dormant;
 		bool sequential_download;
 		bool is_seeding;
 		bool is_finished;
@@ -70,7 +70,17 @@ namespace libtorrent
 		udp_socket(io_service& ios, connection_queue& cc);
 		~udp_socket();
 
-		enum flags_t { dont_drop = 1, peer_connection = 2 };
+		// [MF] batch: the packet may be held back and sent together with
+		// others queued from the same io_service handler (sendmmsg).
+		enum flags_t { dont_drop = 1, peer_connection = 2, batch = 4 };
+
+#if TORRENT_USE_MMSG
+		// number of datagrams received (recvmmsg) or sent (sendmmsg)
+		// per system call
+		enum { read_batch_size = 16, send_batch_size = 32 };
+#else
+		enum { read_batch_size = 1 };
+#endif
 
 		bool is_open() const
 		{
@@ -172,7 +182,13 @@ namespace libtorrent
 		void setup_read(udp::socket* s);
 		void on_read(error_code const& ec, udp::socket* s);
 		void on_read_impl(udp::socket* sock, udp::endpoint const& ep
-			, error_code const& e, std::size_t bytes_transferred);
+			, error_code const& e, char const* buf, std::size_t bytes_transferred);
+#if TORRENT_USE_MMSG
+		bool read_batch(udp::socket* s);
+		void queue_send_batch(udp::endpoint const& ep, char const* p, int len);
+		void on_flush_send_batch();
+		void flush_send_batch();
+#endif
 		void on_name_lookup(error_code const& e, tcp::resolver::iterator i);
 		void on_timeout();
 		void on_connect(int ticket);
@@ -217,8 +233,30 @@ namespace libtorrent
 		// the desired size, and it's resized
 		// later
 		int m_new_buf_size;
+		// read_batch_size slots of m_buf_size bytes each
 		char* m_buf;
 
+#if TORRENT_USE_MMSG
+		struct batched_packet
+		{
+			udp::endpoint ep;
+			int offset; // into m_send_batch_buf
+			int len;
+		};
+
+		// packets sent with the batch flag, waiting for flush_send_batch
+		std::vector<batched_packet> m_send_batch;
+		std::vector<char> m_send_batch_buf;
+		bool m_send_batch_posted;
+
+		// true while the datagrams of a recvmmsg call are being
+		// handled. m_buf may not be reallocated in the meantime
+		bool m_reading_batch;
+
+		// cleared if the kernel doesn't support recvmmsg/sendmmsg
+		bool m_use_mmsg;
+#endif
+
 #if TORRENT_USE_IPV6
 		udp::socket m_ipv6_sock;
 #endif
@@ -281,6 +319,7 @@ namespace libtorrent
 	{
 		rate_limited_udp_socket(io_service& ios, connection_queue& cc);
 		void set_rate_limit(int limit) { m_rate_limit = limit; }
+		int rate_limit() const { return m_rate_limit; }
 		bool send(udp::endpoint const& ep, char const* p, int len, error_code& ec, int flags = 0);
 
 	private:
@@ -241,6 +241,14 @@ namespace libtorrent {
 	}
 
 
+	std::string piece_dropped_alert::message() const
+	{
+		char ret[200];
+		snprintf(ret, sizeof(ret), "%s piece: %u dropped"
+			, torrent_alert::message().c_str(), piece_index);
+		return ret;
+	}
+
 	std::string request_dropped_alert::message() const
 	{
 		char ret[200];
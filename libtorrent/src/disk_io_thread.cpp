@@ -823,7 +823,8 @@ namespace libtorrent
 				return -1;
 			}
 
-            if (ret < 0)
+            //[MF] a piece not found in storage reads as 0 bytes. never cache it.
+            if (ret <= 0)
 			{
 				// this means the file wasn't big enough for this read
 				p.storage->get_storage_impl()->set_error(""
@@ -855,7 +856,8 @@ namespace libtorrent
 				return -1;
 			}
 
-            if (ret < 0)
+            //[MF] a piece not found in storage reads as 0 bytes. never cache it.
+            if (ret <= 0)
 			{
 				// this means the file wasn't big enough for this read
 				p.storage->get_storage_impl()->set_error(""
@@ -1243,6 +1245,15 @@ namespace libtorrent
         return j.buffer_size;
     }
 
+	// [MF] removes j's piece from the read cache, if it's there
+	void disk_io_thread::drop_read_piece(disk_io_job const& j, mutex::scoped_lock& l)
+	{
+		cache_piece_index_t::iterator p = find_cached_piece(m_read_pieces, j, l);
+		if (p == m_read_pieces.get<0>().end()) return;
+		free_piece(const_cast<cached_piece_entry&>(*p), l);
+		m_read_pieces.get<0>().erase(p);
+	}
+
     int disk_io_thread::try_read_from_cache(disk_io_job & j, bool& hit, int flags)
 	{
 		TORRENT_ASSERT(j.buffer);
@@ -1271,6 +1282,11 @@ namespace libtorrent
 			// go go straight to disk
 			if (m_settings.explicit_read_cache) return -2;
 
+			//[MF] the piece is being rewritten and storage still holds the
+			// old content. don't cache it, read it uncached instead.
+			if (find_cached_piece(m_pieces, j, l) != m_pieces.get<0>().end())
+				return -2;
+
 			ret = cache_read_block(j, l);
 			hit = false;
 			if (ret < 0) return ret;
@@ -2076,6 +2092,10 @@ namespace libtorrent
 					TORRENT_ASSERT(!j.storage->error());
 					TORRENT_ASSERT(j.cache_min_time >= 0);
 
+					//[MF] twister pieces may be written again with a different
+					// content (and size). drop the stale copy from the read cache.
+					drop_read_piece(j, l);
+
 					if (in_use() >= m_settings.cache_size)
 					{
 						flush_cache_blocks(l, in_use() - m_settings.cache_size + 1);
@@ -2215,6 +2235,8 @@ namespace libtorrent
                         TORRENT_ASSERT(i->storage);
 						int ret = flush_range(const_cast<cached_piece_entry&>(*i), 0, INT_MAX, l);
 						idx.erase(i);
+						//[MF] a read since the write may have cached the old content
+						drop_read_piece(j, l);
 						if (test_error(j))
 						{
 							ret = -1;
@@ -77,6 +77,15 @@ void dht_get_observer::reply(msg const& m)
 #endif
 		return;
 	}
+
+	// [MF] the lookup already completed early: don't spend time verifying
+	// signatures or following nodes of late replies
+	if (static_cast<dht_get*>(m_algorithm.get())->m_done)
+	{
+		done();
+		return;
+	}
+
 	lazy_entry const* token = r->dict_find_string("token");
 	if (token)
 	{
@@ -169,7 +178,7 @@ void dht_get_observer::reply(msg const& m)
 	}
 
 	// look for nodes
-	n = r->dict_find_string("nodes");
+	n = static_cast<dht_get*>(m_algorithm.get())->m_fixed ? NULL : r->dict_find_string("nodes");
 	if (n)
 	{
 		std::vector<node_entry> node_list;
@@ -185,7 +194,7 @@ void dht_get_observer::reply(msg const& m)
 		}
 	}
 
-	n = r->dict_find_list("nodes2");
+	n = static_cast<dht_get*>(m_algorithm.get())->m_fixed ? NULL : r->dict_find_list("nodes2");
 	if (n)
 	{
 		for (int i = 0; i < n->list_size(); ++i)
@@ -223,7 +232,8 @@ dht_get::dht_get(
 	, data_callback const& dcallback
 	, nodes_callback const& ncallback
 	, bool justToken
-	, bool dontDrop)
+	, bool dontDrop
+	, std::vector<node_entry> const* nodes)
 	: traversal_algorithm(node, node_id())
 	, m_data_callback(dcallback)
 	, m_nodes_callback(ncallback)
@@ -235,6 +245,11 @@ dht_get::dht_get(
 	, m_got_data(false)
 	, m_justToken(justToken)
 	, m_dontDrop(dontDrop)
+	, m_early(false)
+	, m_fixed(nodes != NULL)
+	, m_best_seq(-1)
+	, m_seq_agree(0)
+	, m_stale_replies(0)
 {
 	m_target["n"] = m_targetUser;
 	m_target["r"] = m_targetResource;
@@ -250,6 +265,13 @@ dht_get::dht_get(
 	//TORRENT_LOG(traversal) << "[" << this << "] NEW"
 	//	" target: " << target << " k: " << m_node.m_table.bucket_size();
 #endif
+	if (m_fixed)
+	{
+		for (std::vector<node_entry>::const_iterator i = nodes->begin()
+			, end(nodes->end()); i != end; ++i)
+			add_entry(i->id, i->ep(), observer::flag_initial);
+		return;
+	}
 	node.m_table.for_each_node(&add_entry_fun, 0, (traversal_algorithm*)this);
 }
 
@@ -263,13 +285,18 @@ observer_ptr dht_get::new_observer(void* ptr
 	return o;
 }
 
+void dht_get::allow_early_completion()
+{
+	// trackers are not signed and are also used to decide whether we
+	// are a neighbor of the target, which needs the full traversal
+	m_early = !m_justToken && m_targetResource != "tracker"
+		&& m_node.settings().get_quorum > 0;
+}
+
 bool dht_get::invoke(observer_ptr o)
 {
-	if (m_done)
-	{
-		m_invoke_count = -1;
-		return false;
-	}
+	// completed early: the remaining nodes are not queried
+	if (m_done) return false;
 
 	entry e;
 	e["z"] = "q";
@@ -284,16 +311,83 @@ bool dht_get::invoke(observer_ptr o)
 
 void dht_get::got_data(entry::list_type const& values_list)
 {
+	if (m_done) return;
 	if (!values_list.empty()) m_got_data = true;
 	m_data_callback(values_list);
+
+	if (m_early && !values_list.empty() && replies_agree(values_list))
+	{
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+		TORRENT_LOG(traversal) << "[" << this << "] getData replies agree"
+			<< " invoke-count: " << m_invoke_count;
+#endif
+		// outstanding requests are left to finish (or time out) on their
+		// own, the caller is told right away
+		m_done = true;
+		report_nodes();
+	}
+}
+
+// single: quorum replies carry the newest seq seen so far.
+// multi: the last quorum replies brought no new entry, or we have
+// as many entries as a node would store.
+bool dht_get::replies_agree(entry::list_type const& values_list)
+{
+	int quorum = m_node.settings().get_quorum;
+
+	if (!m_multi)
+	{
+		boost::int64_t seq = -1;
+		for (entry::list_type::const_iterator i = values_list.begin()
+			, end(values_list.end()); i != end; ++i)
+		{
+			entry const* p = i->find_key("p");
+			entry const* s = p ? p->find_key("seq") : NULL;
+			if (s && s->type() == entry::int_t && s->integer() > seq)
+				seq = s->integer();
+		}
+		if (seq > m_best_seq)
+		{
+			m_best_seq = seq;
+			m_seq_agree = 1;
+		}
+		else if (seq == m_best_seq)
+		{
+			++m_seq_agree;
+		}
+		return m_seq_agree >= quorum;
+	}
+
+	bool got_new = false;
+	for (entry::list_type::const_iterator i = values_list.begin()
+		, end(values_list.end()); i != end; ++i)
+	{
+		entry const* sig_p = i->find_key("sig_p");
+		if (sig_p && sig_p->type() == entry::string_t
+			&& m_sig_ps.insert(sig_p->string()).second)
+			got_new = true;
+	}
+	m_stale_replies = got_new ? 0 : m_stale_replies + 1;
+	return m_stale_replies >= quorum
+		|| int(m_sig_ps.size()) >= m_node.settings().max_entries_per_multi;
 }
 
 void dht_get::done()
 {
 	if (m_invoke_count != 0) return;
 
-	m_done = true;
+	// the caller was already told if we completed early
+	if (!m_done)
+	{
+		m_done = true;
+		report_nodes();
+	}
+
+	traversal_algorithm::done();
+}
 
+void dht_get::report_nodes()
+{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 	TORRENT_LOG(traversal) << "[" << this << "] getData DONE";
 #endif
@@ -312,8 +406,6 @@ void dht_get::done()
 		--num_results;
 	}
 	m_nodes_callback(results, m_got_data, target());
-
-	traversal_algorithm::done();
 }
 
 } } // namespace libtorrent::dht
@@ -318,6 +318,8 @@ namespace libtorrent { namespace dht
 	{
 		if (e || m_abort) return;
 
+		// [MF] dht_upload_rate_limit also budgets storage refresh
+		m_dht.set_upload_rate_limit(m_sock.rate_limit());
 		m_dht.tick();
 		error_code ec;
 		m_refresh_timer.expires_from_now(seconds(5), ec);
@@ -663,7 +665,8 @@ namespace libtorrent { namespace dht
 		log_line << print_entry(print, true);
 #endif
 
-		if (m_sock.send(addr, &m_send_buf[0], (int)m_send_buf.size(), ec, send_flags))
+		// [MF] dht packets may be coalesced into a single sendmmsg call
+		if (m_sock.send(addr, &m_send_buf[0], (int)m_send_buf.size(), ec, send_flags | udp_socket::batch))
 		{
 			if (ec) return false;
 
@@ -698,5 +701,47 @@ namespace libtorrent { namespace dht
 		}
 	}
 
+	// [MF] same as send_packet() for a reply, but the "r" dictionary comes
+	// already encoded, so the message is written straight into m_send_buf.
+	// keys are in the order bencode() would have sorted them: r, t, v, z
+	bool dht_tracker::send_reply(std::string const& t, char const* r, int len
+		, udp::endpoint const& addr, int send_flags)
+	{
+		static char const version_str[] = {'L', 'T'
+			, LIBTORRENT_VERSION_MAJOR, LIBTORRENT_VERSION_MINOR};
+
+		m_send_buf.clear();
+		bencode_writer<std::vector<char> > w(m_send_buf);
+		w.begin_dict();
+		w.key("r");
+		w.raw(r, len);
+		w.key("t");
+		w.string(t);
+		w.key("v");
+		w.string(version_str, 4);
+		w.key("z");
+		w.string("r", 1);
+		w.end();
+		error_code ec;
+
+		if (m_sock.send(addr, &m_send_buf[0], (int)m_send_buf.size(), ec, send_flags | udp_socket::batch))
+		{
+			if (ec) return false;
+
+			// account for IP and UDP overhead
+			m_sent_bytes += m_send_buf.size() + (addr.address().is_v6() ? 48 : 28);
+
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+			m_total_out_bytes += m_send_buf.size();
+			TORRENT_LOG(dht_tracker) << "==> " << addr << " reply " << m_send_buf.size() << " bytes";
+#endif
+			return true;
+		}
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+		TORRENT_LOG(dht_tracker) << "==> " << addr << " DROPPED reply";
+#endif
+		return false;
+	}
+
 }}
 
@@ -33,6 +33,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/pch.hpp"
 
 #include <utility>
+#include <limits>
 #include <boost/bind.hpp>
 #include <boost/function/function1.hpp>
 //#include <boost/date_time/posix_time/time_formatters_limited.hpp>
@@ -93,23 +94,65 @@ extern int g_announces;
 
 #endif
 
+tcp::endpoint peer_endpoint(peer_entry_v4 const& p)
+{
+	char const* in = p.addr;
+	return detail::read_v4_endpoint<tcp::endpoint>(in);
+}
+
+tcp::endpoint peer_endpoint(peer_entry_v6 const& p)
+{
+	char const* in = p.addr;
+	return detail::read_v6_endpoint<tcp::endpoint>(in);
+}
+
 // remove peers that have timed out
-void purge_peers(std::set<peer_entry>& peers)
+template <class PeerEntry>
+void purge_peers(std::vector<PeerEntry>& peers)
 {
-	for (std::set<peer_entry>::iterator i = peers.begin()
-		  , end(peers.end()); i != end;)
+	ptime const timeout = time_now() - minutes(int(announce_interval * 1.5f));
+	// compact in place, keeping the endpoint order
+	typename std::vector<PeerEntry>::iterator out = peers.begin();
+	for (typename std::vector<PeerEntry>::iterator i = peers.begin()
+		, end(peers.end()); i != end; ++i)
 	{
 		// the peer has timed out
-		if (i->added + minutes(int(announce_interval * 1.5f)) < time_now())
+		if (i->added < timeout)
 		{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
-			TORRENT_LOG(node) << "peer timed out at: " << i->addr;
+			TORRENT_LOG(node) << "peer timed out at: " << peer_endpoint(*i);
 #endif
-			peers.erase(i++);
+			continue;
 		}
-		else
-			++i;
+		if (out != i) *out = *i;
+		++out;
+	}
+	peers.erase(out, peers.end());
+}
+
+// add peer, or refresh it if the endpoint is already known. a new peer
+// takes the place of the oldest one once there are max_peers
+template <class PeerEntry>
+void add_peer_entry(std::vector<PeerEntry>& peers, char const* addr, bool seed, int max_peers)
+{
+	typename std::vector<PeerEntry>::iterator i = std::lower_bound(peers.begin()
+		, peers.end(), addr, compact_endpoint_less());
+	if (i == peers.end() || !i->same_endpoint(addr))
+	{
+		int pos = i - peers.begin();
+		if (max_peers > 0 && int(peers.size()) >= max_peers)
+		{
+			int oldest = 0;
+			for (int j = 1; j < int(peers.size()); ++j)
+				if (peers[j].added < peers[oldest].added) oldest = j;
+			peers.erase(peers.begin() + oldest);
+			if (oldest < pos) --pos;
+		}
+		i = peers.insert(peers.begin() + pos, PeerEntry());
+		std::memcpy(i->addr, addr, sizeof(i->addr));
 	}
+	i->added = time_now();
+	i->seed = seed;
 }
 
 void nop() {}
@@ -126,6 +169,8 @@ node_impl::node_impl(alert_dispatcher* alert_disp
 	, m_posts_by_user()
 	, m_last_tracker_tick(time_now())
 	, m_next_storage_refresh(time_now())
+	, m_refresh_cursor((node_id::min)())
+	, m_upload_rate_limit(0)
 	, m_post_alert(alert_disp)
 	, m_sock(sock)
 {
@@ -263,8 +308,8 @@ void node_impl::incoming(msg const& m)
 			// new request received
 			TORRENT_ASSERT(m.message.dict_find_string_value("z") == "q");
 			entry e;
-			incoming_request(m, e);
-			m_sock->send_packet(e, m.addr, 0);
+			if (incoming_request(m, e))
+				m_sock->send_packet(e, m.addr, 0);
 			break;
 		}
 		case 'e':
@@ -559,6 +604,7 @@ void node_impl::getData(std::string const &username, std::string const &resource
 	boost::intrusive_ptr<dht_get> ta(new dht_get(*this, username, resource, multi,
 		 fdata,
 		 boost::bind(&getDataDone_fun, _1, _2, _3, boost::ref(*this), fdone), false, local));
+	ta->allow_early_completion();
 	ta->start();
 }
 
@@ -572,6 +618,9 @@ void node_impl::tick()
     if (now > m_next_storage_refresh ) {
         refresh_storage();
     }
+    if (!m_refresh_queue.empty()) {
+        send_refresh_batch();
+    }
 }
 
 void node_impl::process_newly_stored_entry(const lazy_entry &p)
@@ -613,6 +662,12 @@ void node_impl::process_newly_stored_entry(const lazy_entry &p)
     }
 }
 
+// [MF] items cleared by refresh_storage after a failed deferred signature check
+static bool is_dropped_item(dht_storage_item const& item)
+{
+    return item.p.empty();
+}
+
 bool node_impl::refresh_storage() {
     bool did_something = false;
 
@@ -640,6 +695,15 @@ bool node_impl::refresh_storage() {
                 continue;
             }
 
+            if( !item.sig_checked ) {
+                if( !verifySignature(item.p, item.sig_user, item.sig_p) ) {
+                    printf("node dht: dropping stored item, verifySignature failed\n");
+                    item.p.clear();
+                    continue;
+                }
+                item.sig_checked = true;
+            }
+
             bool skip = false;
             bool local_and_recent = (item.local_add_time && item.local_add_time + 60*60*24*2 > time(NULL));
             
@@ -691,19 +755,33 @@ bool node_impl::refresh_storage() {
                            resource.c_str(),
                            target->dict_find_string_value("t").c_str());
 #endif
-                entry entryP;
-                entryP = p; // lazy to non-lazy
-
-                // search for nodes with ids close to id or with peers
-                // for info-hash id. then send putData to them.
-                boost::intrusive_ptr<dht_get> ta(new dht_get(*this, username, resource, multi,
-                                                             boost::bind(&putData_confirm, _1, boost::ref(item)),
-                                                             boost::bind(&putData_fun, _1, boost::ref(*this),
-                                                                         entryP, item.sig_p, item.sig_user),
-                                                             item.confirmed,
-                                                             item.local_add_time));
-                ta->start();
-                did_something = true;
+                // [MF] queue it for the refresh planner (send_refresh_batch),
+                // unless it is still waiting there from the last round
+                bool queued = false;
+                std::pair<refresh_queue_t::iterator, refresh_queue_t::iterator> range =
+                        m_refresh_queue.equal_range(i->first);
+                for( refresh_queue_t::iterator q = range.first; q != range.second; ++q ) {
+                    if( q->second.sig_p == item.sig_p ) {
+                        queued = true;
+                        break;
+                    }
+                }
+
+                if( !queued ) {
+                    refresh_job job;
+                    job.username = username;
+                    job.resource = resource;
+                    job.multi = multi;
+                    job.p = p; // lazy to non-lazy
+                    job.sig_p = item.sig_p;
+                    job.sig_user = item.sig_user;
+                    job.confirmed = item.confirmed;
+                    job.dont_drop = item.local_add_time;
+                    // a getData and a putData (with the item and some overhead) per node
+                    job.cost = m_table.bucket_size() * (item.p.size() + 300);
+                    m_refresh_queue.insert(std::make_pair(i->first, job));
+                    did_something = true;
+                }
             }
 
             // we are supposed to have refreshed this item by now (but we may have not - see above)
@@ -713,6 +791,7 @@ bool node_impl::refresh_storage() {
                 m_next_storage_refresh = item.next_refresh_time;
             }
         }
+        lsto.remove_if(&is_dropped_item);
     }
 /*
     printf("node dht: next storage refresh in %d\n",
@@ -721,6 +800,108 @@ bool node_impl::refresh_storage() {
     return did_something;
 }
 
+// [MF] refresh planner. due items wait in m_refresh_queue, sorted by target.
+// items whose targets share enough leading bits to have the same k closest
+// nodes form a group: a single traversal finds those nodes (and stores the
+// first item), the others only need a direct getData to each of them for
+// the write token. at most half of the dht upload rate is spent per tick
+// (every 5 seconds), the rest of the queue waits for the following ticks.
+void node_impl::send_refresh_batch()
+{
+    const static int max_group_size = 16;
+
+    int budget = m_upload_rate_limit > 0 ? m_upload_rate_limit * 5 / 2
+                                         : std::numeric_limits<int>::max();
+
+    // prefix length shared by a target and its k closest nodes
+    int bits = 0;
+    for( size_type n = m_table.num_global_nodes() / m_table.bucket_size(); n > 1; n >>= 1 )
+        ++bits;
+
+    while( !m_refresh_queue.empty() && budget > 0 ) {
+        // continue where the last batch stopped, so every neighbourhood gets its turn
+        refresh_queue_t::iterator i = m_refresh_queue.lower_bound(m_refresh_cursor);
+        if( i == m_refresh_queue.end() )
+            i = m_refresh_queue.begin();
+
+        node_id const leader = i->first;
+        boost::shared_ptr<refresh_group_t> group(new refresh_group_t);
+        // the traversal of the group
+        int cost = m_table.bucket_size() * 450;
+        while( i != m_refresh_queue.end() && int(group->size()) < max_group_size &&
+               (i->first == leader || distance_exp(leader, i->first) < 160 - bits) ) {
+            cost += i->second.cost;
+            group->push_back(*i);
+            m_refresh_queue.erase(i++);
+        }
+        m_refresh_cursor = (i == m_refresh_queue.end()) ? (node_id::min)() : i->first;
+        budget -= cost;
+
+#ifdef TORRENT_DHT_VERBOSE_LOGGING
+        printf("node dht: refreshing %d items near [%s,%s] (%d queued)\n",
+               int(group->size()), group->front().second.username.c_str(),
+               group->front().second.resource.c_str(), int(m_refresh_queue.size()));
+#endif
+        refresh_job const& j = group->front().second;
+        boost::intrusive_ptr<dht_get> ta(new dht_get(*this, j.username, j.resource, j.multi,
+                                                     boost::bind(&node_impl::confirm_refresh, this, _1, leader, j.sig_p),
+                                                     boost::bind(&node_impl::refresh_group, this, _1, group),
+                                                     j.confirmed, j.dont_drop));
+        ta->start();
+    }
+}
+
+// the traversal for the first item of a group is done: v holds the closest
+// nodes with their write tokens for that target.
+void node_impl::refresh_group(std::vector<std::pair<node_entry, std::string> > const& v
+    , boost::shared_ptr<refresh_group_t> group)
+{
+    refresh_group_t::const_iterator i = group->begin();
+    node_id const leader = i->first;
+    putData_fun(v, *this, i->second.p, i->second.sig_p, i->second.sig_user);
+
+    // nobody found: the rest is retried at its next refresh time
+    if( v.empty() )
+        return;
+
+    std::vector<node_entry> nodes;
+    for (std::vector<std::pair<node_entry, std::string> >::const_iterator k = v.begin()
+        , end(v.end()); k != end; ++k)
+        nodes.push_back(k->first);
+
+    for( ++i; i != group->end(); ++i ) {
+        refresh_job const& j = i->second;
+        // tokens are per target: other items of the same (multi) target can use them as is
+        if( i->first == leader && j.confirmed ) {
+            putData_fun(v, *this, j.p, j.sig_p, j.sig_user);
+            continue;
+        }
+        boost::intrusive_ptr<dht_get> ta(new dht_get(*this, j.username, j.resource, j.multi,
+                                                     boost::bind(&node_impl::confirm_refresh, this, _1, i->first, j.sig_p),
+                                                     boost::bind(&putData_fun, _1, boost::ref(*this),
+                                                                 j.p, j.sig_p, j.sig_user),
+                                                     j.confirmed, j.dont_drop, &nodes));
+        ta->start();
+    }
+}
+
+// the item may have been replaced or dropped while its refresh was queued
+void node_impl::confirm_refresh(entry::list_type const& values_list
+    , node_id const& target, std::string const& sig_p)
+{
+    dht_storage_table_t::iterator i = m_storage_table.find(target);
+    if( i == m_storage_table.end() )
+        return;
+
+    dht_storage_list_t& lsto = i->second;
+    for( dht_storage_list_t::iterator j = lsto.begin(); j != lsto.end(); ++j ) {
+        if( j->sig_p == sig_p ) {
+            putData_confirm(values_list, *j);
+            return;
+        }
+    }
+}
+
 bool node_impl::has_expired(dht_storage_item const& item, bool skipSigCheck) {
     // dont expire if block chain is invalid
     if( getBestHeight() < 1 )
@@ -838,7 +1019,9 @@ void node_impl::load_storage(entry const* e) {
                 item.confirmed = (confirmed->integer() != 0);
             }
 
-            bool expired = has_expired(item);
+            // signature is checked by refresh_storage, before the item is first refreshed
+            item.sig_checked = false;
+            bool expired = has_expired(item, true);
             if( !expired ) {
                 lazy_entry p;
                 int pos;
@@ -887,10 +1070,11 @@ time_duration node_impl::connection_timeout()
 		torrent_entry& t = i->second;
 		node_id const& key = i->first;
 		++i;
-		purge_peers(t.peers);
+		purge_peers(t.peers4);
+		purge_peers(t.peers6);
 
 		// if there are no more peers, remove the entry altogether
-		if (t.peers.empty())
+		if (t.num_peers() == 0)
 		{
 			table_t::iterator i = m_map.find(key);
 			if (i != m_map.end()) m_map.erase(i);
@@ -906,6 +1090,7 @@ void node_impl::status(session_status& s)
 
 	m_table.status(s);
 	s.dht_torrents = int(m_map.size());
+	s.dht_storage_items = int(m_storage_table.size());
 	s.active_requests.clear();
 	s.dht_total_allocations = m_rpc.num_allocated_observers();
 	for (std::set<traversal_algorithm*>::iterator i = m_running_requests.begin()
@@ -946,11 +1131,19 @@ void node_impl::lookup_peers(sha1_hash const& info_hash, int prefix, entry& repl
 		bloom_filter<256> downloaders;
 		bloom_filter<256> seeds;
 
-		for (std::set<peer_entry>::const_iterator i = v.peers.begin()
-			, end(v.peers.end()); i != end; ++i)
+		for (std::vector<peer_entry_v4>::const_iterator i = v.peers4.begin()
+			, end(v.peers4.end()); i != end; ++i)
 		{
 			sha1_hash iphash;
-			hash_address(i->addr.address(), iphash);
+			hash_address(peer_endpoint(*i).address(), iphash);
+			if (i->seed) seeds.set(iphash);
+			else downloaders.set(iphash);
+		}
+		for (std::vector<peer_entry_v6>::const_iterator i = v.peers6.begin()
+			, end(v.peers6.end()); i != end; ++i)
+		{
+			sha1_hash iphash;
+			hash_address(peer_endpoint(*i).address(), iphash);
 			if (i->seed) seeds.set(iphash);
 			else downloaders.set(iphash);
 		}
@@ -960,22 +1153,45 @@ void node_impl::lookup_peers(sha1_hash const& info_hash, int prefix, entry& repl
 	}
 	else
 	{
-		int num = (std::min)((int)v.peers.size(), m_settings.max_peers_reply);
-		std::set<peer_entry>::const_iterator iter = v.peers.begin();
+		int const n4 = int(v.peers4.size());
+
+		// v4 peers come first in the index space. with noseed only the
+		// downloaders are candidates, so seeds don't make the reply short
+		std::vector<int> candidates;
+		if (noseed)
+		{
+			for (int i = 0; i < n4; ++i)
+				if (!v.peers4[i].seed) candidates.push_back(i);
+			for (int i = 0; i < int(v.peers6.size()); ++i)
+				if (!v.peers6[i].seed) candidates.push_back(n4 + i);
+		}
+
+		int const total = noseed ? int(candidates.size()) : v.num_peers();
+		int const num = (std::min)(total, m_settings.max_peers_reply);
 		entry::list_type& pe = reply["values"].list();
-		std::string endpoint;
 
-		for (int t = 0, m = 0; m < num && iter != v.peers.end(); ++iter, ++t)
+		// pick num distinct indices out of [0, total) (Floyd's algorithm)
+		std::set<int> picked;
+		for (int j = total - num; j < total; ++j)
 		{
-			if ((random() / float(UINT_MAX + 1.f)) * (num - t) >= num - m) continue;
-			if (noseed && iter->seed) continue;
-			endpoint.resize(18);
-			std::string::iterator out = endpoint.begin();
-			write_endpoint(iter->addr, out);
-			endpoint.resize(out - endpoint.begin());
-			pe.push_back(entry(endpoint));
-
-			++m;
+			int t = random() % (j + 1);
+			if (!picked.insert(t).second)
+			{
+				t = j;
+				picked.insert(t);
+			}
+			if (noseed) t = candidates[t];
+
+			if (t < n4)
+			{
+				peer_entry_v4 const& p = v.peers4[t];
+				pe.push_back(entry(std::string(p.addr, sizeof(p.addr))));
+			}
+			else
+			{
+				peer_entry_v6 const& p = v.peers6[t - n4];
+				pe.push_back(entry(std::string(p.addr, sizeof(p.addr))));
+			}
 		}
 	}
 	return;
@@ -994,13 +1210,13 @@ void node_impl::add_peer(std::string const &name, sha1_hash const& info_hash, ad
 	}
 	if (list_peers) v.list_peers = list_peers;
 
-	peer_entry peer;
-	peer.addr = tcp::endpoint(addr, port);
-	peer.added = time_now();
-	peer.seed = seed;
-	std::set<peer_entry>::iterator i = v.peers.find(peer);
-	if (i != v.peers.end()) v.peers.erase(i++);
-	v.peers.insert(i, peer);
+	char endpoint[18];
+	char* out = endpoint;
+	write_endpoint(tcp::endpoint(addr, port), out);
+	if (addr.is_v4())
+		add_peer_entry(v.peers4, endpoint, seed, m_settings.max_torrent_peers);
+	else
+		add_peer_entry(v.peers6, endpoint, seed, m_settings.max_torrent_peers);
 }
 
 namespace
@@ -1040,6 +1256,50 @@ namespace
 			}
 		}
 	}
+
+	// [MF] same as write_nodes_entry() for a reply being streamed
+	void write_nodes_stream(bencode_writer<std::vector<char> >& w, nodes_t const& nodes)
+	{
+		int num_v4 = 0;
+		int num_v6 = 0;
+		for (nodes_t::const_iterator i = nodes.begin()
+			, end(nodes.end()); i != end; ++i)
+		{
+			if (i->addr().is_v4()) ++num_v4;
+			else ++num_v6;
+		}
+
+		char buf[20 + 18];
+		w.key("nodes");
+		w.length_prefix(num_v4 * (20 + 6));
+		for (nodes_t::const_iterator i = nodes.begin()
+			, end(nodes.end()); i != end; ++i)
+		{
+			if (!i->addr().is_v4()) continue;
+			char* out = buf;
+			std::copy(i->id.begin(), i->id.end(), out);
+			out += 20;
+			write_endpoint(udp::endpoint(i->addr(), i->port()), out);
+			w.raw(buf, int(out - buf));
+		}
+
+		if (num_v6)
+		{
+			w.key("nodes2");
+			w.begin_list();
+			for (nodes_t::const_iterator i = nodes.begin()
+				, end(nodes.end()); i != end; ++i)
+			{
+				if (!i->addr().is_v6()) continue;
+				char* out = buf;
+				std::copy(i->id.begin(), i->id.end(), out);
+				out += 20;
+				write_endpoint(udp::endpoint(i->addr(), i->port()), out);
+				w.string(buf, int(out - buf));
+			}
+			w.end();
+		}
+	}
 }
 
 // verifies that a message has all the required
@@ -1140,8 +1400,8 @@ void incoming_error(entry& e, char const* msg)
 	l.push_back(entry(msg));
 }
 
-// build response
-void node_impl::incoming_request(msg const& m, entry& e)
+// build response. returns false if the reply has already been sent
+bool node_impl::incoming_request(msg const& m, entry& e)
 {
 	e = entry(entry::dictionary_t);
 	e["z"] = "r";
@@ -1158,7 +1418,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 	if (!verify_message(&m.message, top_desc, top_level, 3, error_string, sizeof(error_string)))
 	{
 		incoming_error(e, error_string);
-		return;
+		return true;
 	}
 
 	char const* query = top_level[0]->string_cstr();
@@ -1177,7 +1437,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 	if (!verify_id(id, m.addr.address())) {
 		reply["ip"] = address_to_bytes(m.addr.address());
 		//[MF] enforce ID verification.
-		return;
+		return true;
 	}
 
 	if (strcmp(query, "ping") == 0)
@@ -1199,7 +1459,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		if (!verify_message(arg_ent, msg_desc, msg_keys, 4, error_string, sizeof(error_string)))
 		{
 			incoming_error(e, error_string);
-			return;
+			return true;
 		}
 
 		reply["token"] = generate_token(m.addr, msg_keys[0]->string_ptr());
@@ -1236,7 +1496,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		if (!verify_message(arg_ent, msg_desc, msg_keys, 1, error_string, sizeof(error_string)))
 		{
 			incoming_error(e, error_string);
-			return;
+			return true;
 		}
 
 		sha1_hash target(msg_keys[0]->string_ptr());
@@ -1264,7 +1524,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			++g_failed_announces;
 #endif
 			incoming_error(e, error_string);
-			return;
+			return true;
 		}
 
 		int port = int(msg_keys[1]->int_value());
@@ -1280,7 +1540,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			++g_failed_announces;
 #endif
 			incoming_error(e, "invalid port");
-			return;
+			return true;
 		}
 
 		sha1_hash info_hash(msg_keys[0]->string_ptr());
@@ -1297,7 +1557,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			++g_failed_announces;
 #endif
 			incoming_error(e, "invalid token");
-			return;
+			return true;
 		}
 
 		// the token was correct. That means this
@@ -1309,14 +1569,14 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		{
 			// we need to remove some. Remove the ones with the
 			// fewest peers
-			int num_peers = m_map.begin()->second.peers.size();
+			int num_peers = m_map.begin()->second.num_peers();
 			table_t::iterator candidate = m_map.begin();
 			for (table_t::iterator i = m_map.begin()
 				, end(m_map.end()); i != end; ++i)
 			{
-				if (int(i->second.peers.size()) > num_peers) continue;
+				if (i->second.num_peers() > num_peers) continue;
 				if (i->first == info_hash) continue;
-				num_peers = i->second.peers.size();
+				num_peers = i->second.num_peers();
 				candidate = i;
 			}
 			m_map.erase(candidate);
@@ -1354,7 +1614,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		if (!verify_message(arg_ent, msg_desc, msg_keys, 12, error_string, sizeof(error_string)))
 		{
 			incoming_error(e, error_string);
-			return;
+			return true;
 		}
 
 		// is this a multi-item?
@@ -1367,13 +1627,13 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		if (buf.second > maxSize || buf.second <= 0)
 		{
 			incoming_error(e, "message too big");
-			return;
+			return true;
 		}
 
 		// "target" must be a dict of 3 entries
 		if (msg_keys[mk_target]->dict_size() != 3) {
 			incoming_error(e, "target dict size != 3");
-			return;
+			return true;
 		}
 
 		// target id is hash of bencoded dict "target"
@@ -1393,7 +1653,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		if (!verify_token(msg_keys[mk_token]->string_value(), (char const*)&target[0], m.addr))
 		{
 			incoming_error(e, "invalid token");
-			return;
+			return true;
 		}
 
 		std::pair<char const*, int> bufp = msg_keys[mk_p]->data_section();
@@ -1402,40 +1662,40 @@ void node_impl::incoming_request(msg const& m, entry& e)
 				    msg_keys[mk_sig_user]->string_value(),
 				    msg_keys[mk_sig_p]->string_value())) {
 			incoming_error(e, "invalid signature");
-			return;
+			return true;
 		}
 
 		if (!multi && msg_keys[mk_sig_user]->string_value() !=
 			      msg_keys[mk_n]->string_value() ) {
 			incoming_error(e, "only owner is allowed");
-			return;
+			return true;
 		}
 
 		/* we can't check username, otherwise we break hashtags etc.
 		if (multi && !usernameExists(msg_keys[mk_n]->string_value())) {
 			incoming_error(e, "unknown user for resource");
-			return;
+			return true;
 		}
 		*/
 
 		if (msg_keys[mk_r]->string_value().size() > 32) {
 			incoming_error(e, "resource name too big");
-			return;
+			return true;
 		}
 
 		if (!multi && (!msg_keys[mk_seq] || msg_keys[mk_seq]->int_value() < 0)) {
 			incoming_error(e, "seq is required for single");
-			return;
+			return true;
 		}
 
 		if (msg_keys[mk_height]->int_value() > getBestHeight()+1 && getBestHeight() > 0) {
 			incoming_error(e, "height > getBestHeight");
-			return;
+			return true;
 		}
 
 		if (msg_keys[mk_time]->int_value() > GetAdjustedTime() + MAX_TIME_IN_FUTURE) {
 			incoming_error(e, "time > GetAdjustedTime");
-			return;
+			return true;
 		}
 
 		m_table.node_seen(id, m.addr, 0xffff);
@@ -1461,7 +1721,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 			printf("putData with possiblyNeighbor=false, ignoring request.\n");
 #endif
-			return;
+			return true;
 		}
 
 		dht_storage_item item(str_p, msg_keys[mk_sig_p], msg_keys[mk_sig_user]);
@@ -1487,19 +1747,19 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		if (!verify_message(arg_ent, msg_desc, msg_keys, 5, error_string, sizeof(error_string)))
 		{
 			incoming_error(e, error_string);
-			return;
+			return true;
 		}
 
 		// "target" must be a dict of 3 entries
 		if (msg_keys[mk_target]->dict_size() != 3) {
 			incoming_error(e, "target dict size != 3");
-			return;
+			return true;
 		}
 
 		if (msg_keys[mk_t]->string_value() != "s" &&
 			msg_keys[mk_t]->string_value() != "m") {
 			incoming_error(e, "invalid target.t value");
-			return;
+			return true;
 		}
 
 		// target id is hash of bencoded dict "target"
@@ -1521,33 +1781,54 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		nodes_t n;
 		// always return nodes as well as peers
 		m_table.find_node(target, n, 0);
-		write_nodes_entry(reply, n);
 
 		bool hasData = false;
+		bool streamed = false;
 
 		if( msg_keys[mk_r]->string_value() == "tracker" ) {
+			write_nodes_entry(reply, n);
 			lookup_peers(target, 20, reply, false, false);
 			entry::list_type& pe = reply["values"].list();
 			//printf("tracker=> replying with %d peers\n", pe.size());
 		} else {
+			// [MF] this is the hottest query we answer. the stored items are
+			// already bencoded, so the reply is written straight into a reused
+			// buffer instead of being decoded into an entry tree and encoded back.
+			// keys must be written in sorted order: data, id, nodes, nodes2, token
+			m_reply_buf.clear();
+			bencode_writer<std::vector<char> > w(m_reply_buf);
+			w.begin_dict();
+
 			dht_storage_table_t::iterator i = m_storage_table.find(target);
 			if (i != m_storage_table.end())
 			{
 				hasData = true;
-				reply["data"] = entry::list_type();
-				entry::list_type &values = reply["data"].list();
+				w.key("data");
+				w.begin_list();
 
 				dht_storage_list_t const& lsto = i->second;
 				for (dht_storage_list_t::const_iterator j = lsto.begin()
 					  , end(lsto.end()); j != end && !justtoken; ++j)
 				{
-					entry::dictionary_type v;
-					v["p"] = bdecode(j->p.begin(), j->p.end());
-					v["sig_p"] = j->sig_p;
-					v["sig_user"] = j->sig_user;
-					values.push_back(v);
+					w.begin_dict();
+					w.key("p");
+					w.raw(j->p);
+					w.key("sig_p");
+					w.string(j->sig_p);
+					w.key("sig_user");
+					w.string(j->sig_user);
+					w.end();
 				}
+				w.end();
 			}
+
+			w.key("id");
+			w.string(nid().to_string());
+			write_nodes_stream(w, n);
+			w.key("token");
+			w.string(reply["token"].string());
+			w.end();
+			streamed = true;
 		}
 
 		// check distance between target, nodes and our own id
@@ -1569,6 +1850,13 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			alert* a = new dht_get_data_alert(eTarget,possiblyNeighbor,hasData);
 			if (!m_post_alert->post_alert(a)) delete a;
 		}
+
+		if (streamed)
+		{
+			m_sock->send_reply(e["t"].string(), &m_reply_buf[0], int(m_reply_buf.size())
+				, m.addr, 0);
+			return false;
+		}
 	}
 	else
 	{
@@ -1582,7 +1870,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			if (target_ent == 0 || target_ent->string_length() != 20)
 			{
 				incoming_error(e, "unknown message");
-				return;
+				return true;
 			}
 		}
 
@@ -1591,8 +1879,9 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		// always return nodes as well as peers
 		m_table.find_node(target, n, 0);
 		write_nodes_entry(reply, n);
-		return;
+		return true;
 	}
+	return true;
 }
 
 bool node_impl::store_dht_item(dht_storage_item &item, const big_number &target, 
@@ -170,6 +170,7 @@ rpc_manager::rpc_manager(node_id const& our_id
 	, m_allocated_observers(0)
 	, m_destructing(false)
 	, m_observer(observer)
+	, m_rtt(0)
 {
 	std::srand(time(0));
 
@@ -376,6 +377,7 @@ bool rpc_manager::incoming(msg const& m, node_id* id)
 	*id = node_id(node_id_ent->string_ptr());
 
 	int rtt = total_milliseconds(now - o->sent());
+	m_rtt = m_rtt == 0 ? rtt : (m_rtt * 7 + rtt) / 8;
 
 	// we found an observer for this reply, hence the node is not spoofing
 	// add it to the routing table
@@ -386,16 +388,22 @@ time_duration rpc_manager::tick()
 {
 	INVARIANT_CHECK;
 
-	const static int short_timeout = 1;
 	const static int timeout = 8;
 
+	// [MF] a request still in flight after a few times the usual round trip
+	// is most likely lost. opening its slot early (which widens the branch
+	// factor of its traversal) is what keeps lookups fast on a good network,
+	// while slow links keep the original one second.
+	time_duration short_timeout = milliseconds(m_rtt == 0 ? 1000
+		: (std::min)(1000, (std::max)(250, m_rtt * 3)));
+
 	//	look for observers that have timed out
 
-	if (m_transactions.empty()) return seconds(short_timeout);
+	if (m_transactions.empty()) return short_timeout;
 
 	std::list<observer_ptr> timeouts;
 
-	time_duration ret = seconds(short_timeout);
+	time_duration ret = short_timeout;
 	ptime now = time_now();
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
@@ -443,9 +451,9 @@ time_duration rpc_manager::tick()
 		// break, because every observer after this one will
 		// also not have timed out yet
 		time_duration diff = now - o->sent();
-		if (diff < seconds(short_timeout))
+		if (diff < short_timeout)
 		{
-			ret = seconds(short_timeout) - diff;
+			ret = short_timeout - diff;
 			break;
 		}
 		
@@ -1372,6 +1372,7 @@ namespace libtorrent
 		, support_merkle_torrents(false)
 		, report_redundant_bytes(true)
 		, use_disk_cache_pool(false)
+		, dormant_torrent_timeout(10 * 60)
 	{}
 
 	session_settings::~session_settings() {}
@@ -455,6 +455,7 @@ namespace aux {
 		TORRENT_SETTING(integer, tracker_backoff)
 		TORRENT_SETTING(boolean, ban_web_seeds)
 		TORRENT_SETTING(integer, max_http_recv_buffer_size)
+		TORRENT_SETTING(integer, dormant_torrent_timeout)
 	};
 
 #undef TORRENT_SETTING
@@ -483,8 +484,10 @@ namespace aux {
 #endif
 		TORRENT_SETTING(integer, max_fail_count)
 		TORRENT_SETTING(integer, max_torrents)
+		TORRENT_SETTING(integer, max_torrent_peers)
 		TORRENT_SETTING(integer, max_dht_items)
 		TORRENT_SETTING(integer, max_torrent_search_reply)
+		TORRENT_SETTING(integer, get_quorum)
 		TORRENT_SETTING(boolean, restrict_routing_ips)
 		TORRENT_SETTING(boolean, restrict_search_ips)
 		TORRENT_SETTING(boolean, extended_routing_table)
@@ -3352,7 +3355,12 @@ retry:
 				num_downloads_peers += t.num_peers();
 			}
 
-			t.second_tick(m_stat, tick_interval_ms);
+			// [MF] dormant torrents have no peers and nothing to do,
+			// but their timers must keep running like everyone else's
+			if (!t.is_dormant())
+				t.second_tick(m_stat, tick_interval_ms);
+			else if (!t.is_paused())
+				t.update_time_counters();
 			++i;
 		}
 
@@ -5703,6 +5711,7 @@ retry:
 			s.dht_nodes = 0;
 			s.dht_node_cache = 0;
 			s.dht_torrents = 0;
+			s.dht_storage_items = 0;
 			s.dht_global_nodes = 0;
 			s.dht_total_allocations = 0;
 		}
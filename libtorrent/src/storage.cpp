@@ -247,6 +247,7 @@ namespace libtorrent
 		, m_file_priority(file_prio)
 		, m_db_path(path)
 		, m_db(db)
+		, m_db_user_id(0)
 		, m_page_size(page_size())
 		, m_allocate_files(false)
 	{
@@ -257,6 +258,101 @@ namespace libtorrent
 
 	default_storage::~default_storage() { }
 
+	// [MF] pieces are stored in the swarm db keyed by 'P', the varint user id
+	// of the torrent and the big endian slot, so all pieces of a user are
+	// contiguous and sorted by slot.
+	namespace
+	{
+		struct piece_db_key
+		{
+			piece_db_key(boost::uint32_t user_id, int slot) : m_size(0)
+			{
+				// same encoding as bitcoin's VARINT
+				char tmp[5];
+				int len = 0;
+				for (;;)
+				{
+					tmp[len] = (user_id & 0x7f) | (len ? 0x80 : 0x00);
+					if (user_id <= 0x7f) break;
+					user_id = (user_id >> 7) - 1;
+					++len;
+				}
+				m_buf[m_size++] = 'P';
+				do m_buf[m_size++] = tmp[len]; while (len--);
+				m_buf[m_size++] = char(slot >> 24);
+				m_buf[m_size++] = char(slot >> 16);
+				m_buf[m_size++] = char(slot >> 8);
+				m_buf[m_size++] = char(slot);
+			}
+
+			leveldb::Slice slice() const { return leveldb::Slice(m_buf, m_size); }
+
+		private:
+			char m_buf[1 + 5 + 4];
+			int m_size;
+		};
+
+		// ('u', info-hash hex) => user id. 'U' holds the next id to assign
+		mutex db_user_id_mutex;
+	}
+
+	boost::uint32_t default_storage::db_user_id()
+	{
+		if (m_db_user_id) return m_db_user_id;
+
+		mutex::scoped_lock l(db_user_id_mutex);
+		unsigned int user_id = 0;
+		if (!m_db.Read(std::make_pair('u', m_db_path), user_id))
+		{
+			unsigned int next_id = 1;
+			m_db.Read('U', next_id);
+			user_id = next_id++;
+			CLevelDBBatch batch;
+			batch.Write(std::make_pair('u', m_db_path), user_id);
+			batch.Write('U', next_id);
+			m_db.WriteBatch(batch, true);
+		}
+		m_db_user_id = user_id;
+		return m_db_user_id;
+	}
+
+	// [MF] pieces used to be keyed by ('p', (m_db_path, slot)), with the value
+	// serialized as a string. move those of this torrent to the compact layout
+	// in a single batch, so an interrupted migration is simply redone.
+	void default_storage::migrate_db_layout()
+	{
+		CPlainDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+		ssPrefix << std::make_pair('p', m_db_path);
+		leveldb::Slice prefix(&ssPrefix[0], ssPrefix.size());
+
+		boost::uint32_t user_id = db_user_id();
+		CLevelDBBatch batch;
+		int num_pieces = 0;
+
+		boost::scoped_ptr<leveldb::Iterator> it(m_db.NewIterator());
+		for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next())
+		{
+			try
+			{
+				leveldb::Slice key = it->key();
+				CSpanStream ssKey(key.data(), key.data() + key.size(), SER_DISK, CLIENT_VERSION);
+				std::pair<char, std::pair<std::string, int> > old_key;
+				ssKey >> old_key;
+
+				leveldb::Slice value = it->value();
+				CSpanStream ssValue(value.data(), value.data() + value.size(), SER_DISK, CLIENT_VERSION);
+				std::string post;
+				ssValue >> post;
+
+				batch.WriteRaw(piece_db_key(user_id, old_key.second.second).slice(), post);
+				batch.EraseRaw(key);
+				++num_pieces;
+			}
+			catch (std::exception&) {}
+		}
+		if (num_pieces) m_db.WriteBatch(batch);
+	}
+
 	bool default_storage::initialize(bool allocate_files)
 	{
 		m_allocate_files = allocate_files;
@@ -264,6 +360,15 @@ namespace libtorrent
 
 		std::vector<boost::uint8_t>().swap(m_file_priority);
 
+		try
+		{
+			migrate_db_layout();
+		}
+		catch (leveldb_error&)
+		{
+			m_db.RepairDB();
+		}
+
 		return error() ? true : false;
 	}
 
@@ -405,14 +510,15 @@ namespace libtorrent
         TORRENT_ASSERT(num_bufs == 1);
         TORRENT_ASSERT(offset == 0);
 
-        std::string postStr(static_cast<char *>(bufs[0].iov_base), bufs[0].iov_len);
+        leveldb::Slice post(static_cast<char *>(bufs[0].iov_base), bufs[0].iov_len);
 
         int tries = 2;
         while( tries-- ) {
             try {
-                std::pair<std::string, int> pathSlot = std::make_pair(m_db_path, slot);
-                if( m_db.Write(std::make_pair('p', pathSlot), postStr) ) {
-                    return postStr.size();
+                CLevelDBBatch batch;
+                batch.WriteRaw(piece_db_key(db_user_id(), slot).slice(), post);
+                if( m_db.WriteBatch(batch) ) {
+                    return post.size();
                 } else {
                     return -1;
                 }
@@ -450,12 +556,10 @@ namespace libtorrent
         int tries = 2;
         while( tries-- ) {
             try {
-                std::string postStr;
-                std::pair<std::string, int> pathSlot = std::make_pair(m_db_path, slot);
-                if( m_db.Read(std::make_pair('p', pathSlot), postStr) ) {
-                    TORRENT_ASSERT(bufs[0].iov_len >= postStr.size());
-                    memcpy(bufs[0].iov_base, postStr.data(), postStr.size());
-                    return postStr.size();
+                if( m_db.ReadRaw(piece_db_key(db_user_id(), slot).slice(), m_db_value) ) {
+                    TORRENT_ASSERT(bufs[0].iov_len >= m_db_value.size());
+                    memcpy(bufs[0].iov_base, m_db_value.data(), m_db_value.size());
+                    return m_db_value.size();
                 } else {
                     return 0;
                 }
@@ -388,6 +388,7 @@ namespace libtorrent
 		, m_connections_initialized(false)
 		, m_super_seeding(false)
 		, m_following(false)
+		, m_dormant(false)
 		, m_override_resume_data(p.flags & add_torrent_params::flag_override_resume_data)
 #ifndef TORRENT_DISABLE_RESOLVE_COUNTRIES
 		, m_resolving_country(false)
@@ -420,6 +421,7 @@ namespace libtorrent
 		, m_last_download(0)
 		, m_last_upload(0)
 		, m_last_scrape(0)
+		, m_idle_time(0)
 		, m_downloaded(0xffffff)
 		, m_interface_index(0)
 		, m_graceful_pause_mode(false)
@@ -940,6 +942,20 @@ namespace libtorrent
 		}
 	}
 
+	void torrent::get_piece_ids(std::vector<int> *ids, int count, int max_id, int since_id, uint32_t filter_flags)
+	{
+		if( !m_picker ) return;
+
+		max_id = std::min( max_id, m_picker->last_have() );
+
+		for( int i = max_id; i >= 0 && i > since_id && int(ids->size()) < count; i--) {
+			if( m_picker->have_piece(i) &&
+			   (m_picker->post_flags(i) & filter_flags) == m_picker->post_flags(i) ) {
+				ids->push_back(i);
+			}
+		}
+	}
+
 	void torrent::on_disk_read_get_piece_complete(int ret, disk_io_job const& j,
 												  std::vector<std::string> *pieces, mutex *mut, condition_variable *cond, int *reqs)
 	{
@@ -1155,6 +1171,8 @@ namespace libtorrent
 
 		//[MF] increase num pieces to ensure we are not a seeder
 		increase_num_pieces(piece+2);
+		// [MF] a new local post must be seeded
+		wake_up();
 
 		TORRENT_ASSERT(piece >= 0 && piece < m_torrent_file->num_pieces());
 		int piece_size = size;
@@ -2155,6 +2173,7 @@ namespace libtorrent
 		localpeer.address(m_ses.external_address().external_address(address_v4()));
 		localpeer.port(port);
 
+		int num_known_peers = m_policy.num_peers();
 		BOOST_FOREACH(tcp::endpoint const& p, peers) {
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
 		    //debug_log("on_dht_announce_response %s:%d (local=%d)", p.address().to_string().c_str(), p.port(), p==localpeer);
@@ -2169,6 +2188,14 @@ namespace libtorrent
 			, peer_info::dht, 0));
 		*/
 
+		// [MF] a dormant torrent only wakes up if the tracker knows
+		// about peers we haven't seen before
+		if (m_dormant)
+		{
+			if (m_policy.num_peers() == num_known_peers) return;
+			wake_up();
+		}
+
 		do_connect_boost();
 	}
 
@@ -3149,6 +3176,7 @@ namespace libtorrent
 		TORRENT_ASSERT(m_picker);
 
 		m_picker->we_dont_have(index);
+		alerts().post_alert(piece_dropped_alert(get_handle(), index));
 	}
 
 
@@ -3540,6 +3568,38 @@ namespace libtorrent
 		m_following = on;
 	}
 
+	void torrent::go_dormant()
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+		TORRENT_ASSERT(m_connections.empty());
+		if (m_dormant) return;
+
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
+		debug_log("*** going dormant (idle for %d seconds)", int(m_idle_time));
+#endif
+		m_dormant = true;
+		state_updated();
+	}
+
+	void torrent::wake_up()
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+		m_idle_time = 0;
+		if (!m_dormant) return;
+
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
+		debug_log("*** waking up from dormant state");
+#endif
+		m_dormant = false;
+		state_updated();
+		// refresh the peer list from the dht tracker and start
+		// connecting to the peers we already know about
+#ifndef TORRENT_DISABLE_DHT
+		dht_announce();
+#endif
+		do_connect_boost();
+	}
+
 	int torrent::get_piece_to_super_seed(bitfield const& bits)
 	{
 		// return a piece with low availability that is not in
@@ -5002,6 +5062,14 @@ namespace libtorrent
 		m_last_scrape = rd.dict_find_int_value("last_scrape", 0);
 		m_last_download = rd.dict_find_int_value("last_download", 0);
 		m_last_upload = rd.dict_find_int_value("last_upload", 0);
+		// [MF] last_download is relative to when the resume data was
+		// saved, the absolute time (if present) accounts for the time since
+		boost::int64_t last_download_time = rd.dict_find_int_value("last_download_time", 0);
+		if (last_download_time > 0)
+		{
+			boost::int64_t since = boost::int64_t(time(0)) - last_download_time;
+			m_last_download = (std::max)(boost::int64_t(0), (std::min)(since, boost::int64_t(0xffffff)));
+		}
 
 		m_url = rd.dict_find_string_value("url");
 		m_uuid = rd.dict_find_string_value("uuid");
@@ -5186,6 +5254,8 @@ namespace libtorrent
 		ret["last_scrape"] = m_last_scrape;
 		ret["last_download"] = m_last_download;
 		ret["last_upload"] = m_last_upload;
+		// [MF] absolute, so it doesn't go stale while the resume data sits on disk
+		ret["last_download_time"] = boost::int64_t(time(0)) - m_last_download;
 
 		if (!m_url.empty()) ret["url"] = m_url;
 		if (!m_uuid.empty()) ret["uuid"] = m_uuid;
@@ -5910,6 +5980,7 @@ namespace libtorrent
 		}
 		TORRENT_ASSERT(m_connections.find(p) == m_connections.end());
 		m_connections.insert(p);
+		wake_up();
 #ifdef TORRENT_DEBUG
 		error_code ec;
 		TORRENT_ASSERT(p->remote() == p->get_socket()->remote_endpoint(ec) || ec);
@@ -5957,6 +6028,7 @@ namespace libtorrent
 	{
 		return m_connections.size() < m_max_connections
 			&& !is_paused()
+			&& !m_dormant
 			&& ((m_state != torrent_status::checking_files
 			&& m_state != torrent_status::checking_resume_data
 			&& m_state != torrent_status::queued_for_checking)
@@ -7532,13 +7604,7 @@ namespace libtorrent
 		int seconds_since_last_tick = 1;
 		if (m_ses.m_tick_residual >= 1000) ++seconds_since_last_tick;
 
-		if (is_seed()) m_seeding_time += seconds_since_last_tick;
-		if (is_finished()) m_finished_time += seconds_since_last_tick;
-		if (m_upload_mode) m_upload_mode_time += seconds_since_last_tick;
-		m_last_scrape += seconds_since_last_tick;
-		m_active_time += seconds_since_last_tick;
-		m_last_download += seconds_since_last_tick;
-		m_last_upload += seconds_since_last_tick;
+		update_time_counters();
 
 		// ---- TIME CRITICAL PIECES ----
 
@@ -7607,6 +7673,36 @@ namespace libtorrent
 		// if the rate is 0, there's no update because of network transfers
 		if (m_stat.low_pass_upload_rate() > 0 || m_stat.low_pass_download_rate() > 0)
 			state_updated();
+
+		// ---- DORMANT ----
+
+		if (!m_connections.empty() || !m_time_critical_pieces.empty())
+		{
+			m_idle_time = 0;
+		}
+		else
+		{
+			m_idle_time = (std::min)(int(m_idle_time) + seconds_since_last_tick, 0xffff);
+			int timeout = settings().dormant_torrent_timeout;
+			if (timeout > 0 && m_idle_time >= timeout)
+				go_dormant();
+		}
+	}
+
+	void torrent::update_time_counters()
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+
+		int seconds_since_last_tick = 1;
+		if (m_ses.m_tick_residual >= 1000) ++seconds_since_last_tick;
+
+		if (is_seed()) m_seeding_time += seconds_since_last_tick;
+		if (is_finished()) m_finished_time += seconds_since_last_tick;
+		if (m_upload_mode) m_upload_mode_time += seconds_since_last_tick;
+		m_last_scrape += seconds_since_last_tick;
+		m_active_time += seconds_since_last_tick;
+		m_last_download += seconds_since_last_tick;
+		m_last_upload += seconds_since_last_tick;
 	}
 
 	void torrent::recalc_share_mode()
@@ -8408,6 +8504,7 @@ namespace libtorrent
 		st->num_incomplete = (m_incomplete == 0xffffff) ? -1 : m_incomplete;
 		st->paused = is_torrent_paused();
 		st->auto_managed = m_auto_managed;
+		st->dormant = m_dormant;
 		st->sequential_download = m_sequential_download;
 		st->is_seeding = is_seed();
 		st->is_finished = is_finished();
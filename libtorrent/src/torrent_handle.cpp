@@ -80,6 +80,7 @@ namespace libtorrent
 		: state(checking_resume_data)
 		, paused(false)
 		, auto_managed(false)
+		, dormant(false)
 		, sequential_download(false)
 		, is_seeding(false)
 		, is_finished(false)
@@ -238,6 +239,16 @@ namespace libtorrent
     t.reset(); \
     do { ses.cond.wait(l); } while(!done); }
 
+#define TORRENT_SYNC_CALL5(x, a1, a2, a3, a4, a5) \
+    boost::shared_ptr<torrent> t = m_torrent.lock(); \
+    if (t) { \
+    bool done = false; \
+    session_impl& ses = t->session(); \
+    mutex::scoped_lock l(ses.mut); \
+    ses.m_io_service.dispatch(boost::bind(&fun_wrap, &done, &ses.cond, &ses.mut, boost::function<void(void)>(boost::bind(&torrent:: x, t, a1, a2, a3, a4, a5)))); \
+    t.reset(); \
+    do { ses.cond.wait(l); } while(!done); }
+
 #define TORRENT_SYNC_CALL8(x, a1, a2, a3, a4, a5, a6, a7, a8) \
     boost::shared_ptr<torrent> t = m_torrent.lock(); \
     if (t) { \
@@ -839,6 +850,12 @@ namespace libtorrent
 		}
 	}
 
+	void torrent_handle::get_piece_ids(std::vector<int> &ids, int count, int max_id, int since_id, uint32_t filter_flags) const
+	{
+		INVARIANT_CHECK;
+		TORRENT_SYNC_CALL5(get_piece_ids, &ids, count, max_id, since_id, filter_flags);
+	}
+
 	bool torrent_handle::have_piece(int piece) const
 	{
 		INVARIANT_CHECK;
@@ -957,6 +974,12 @@ namespace libtorrent
 #endif
 	}
 
+	void torrent_handle::wake_up() const
+	{
+		INVARIANT_CHECK;
+		TORRENT_ASYNC_CALL(wake_up);
+	}
+
 	void torrent_handle::force_reannounce() const
 	{
 		INVARIANT_CHECK;
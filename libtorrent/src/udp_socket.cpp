@@ -50,6 +50,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/debug.hpp"
 #endif
 
+#if TORRENT_USE_MMSG
+#include <sys/socket.h>
+#include <errno.h>
+#endif
+
 using namespace libtorrent;
 
 udp_socket::udp_socket(asio::io_service& ios
@@ -59,6 +64,11 @@ udp_socket::udp_socket(asio::io_service& ios
 	, m_buf_size(0)
 	, m_new_buf_size(0)
 	, m_buf(0)
+#if TORRENT_USE_MMSG
+	, m_send_batch_posted(false)
+	, m_reading_batch(false)
+	, m_use_mmsg(true)
+#endif
 #if TORRENT_USE_IPV6
 	, m_ipv6_sock(ios)
 #endif
@@ -97,7 +107,7 @@ udp_socket::udp_socket(asio::io_service& ios
 
 	m_buf_size = 10000;
 	m_new_buf_size = m_buf_size;
-	m_buf = (char*)malloc(m_buf_size);
+	m_buf = (char*)malloc(m_buf_size * read_batch_size);
 }
 
 udp_socket::~udp_socket()
@@ -209,6 +219,14 @@ void udp_socket::send(udp::endpoint const& ep, char const* p, int len
 
 	if (m_force_proxy) return;
 
+#if TORRENT_USE_MMSG
+	if ((flags & batch) && m_use_mmsg)
+	{
+		queue_send_batch(ep, p, len);
+		return;
+	}
+#endif
+
 #if TORRENT_USE_IPV6
 	if (ep.address().is_v6() && m_ipv6_sock.is_open())
 		m_ipv6_sock.send_to(asio::buffer(p, len), ep, 0, ec);
@@ -281,18 +299,181 @@ void udp_socket::on_read(error_code const& ec, udp::socket* s)
 
 	CHECK_MAGIC;
 
+#if TORRENT_USE_MMSG
+	if (!m_use_mmsg || !read_batch(s))
+#endif
 	for (;;)
 	{
 		error_code ec;
 		udp::endpoint ep;
 		size_t bytes_transferred = s->receive_from(asio::buffer(m_buf, m_buf_size), ep, 0, ec);
 		if (ec == asio::error::would_block || ec == asio::error::try_again) break;
-		on_read_impl(s, ep, ec, bytes_transferred);
+		on_read_impl(s, ep, ec, m_buf, bytes_transferred);
 	}
 	call_drained_handler();
+#if TORRENT_USE_MMSG
+	// replies to the packets we just handled go out together
+	flush_send_batch();
+#endif
 	setup_read(s);
 }
 
+#if TORRENT_USE_MMSG
+// drain the socket read_batch_size datagrams at a time. Returns false
+// if recvmmsg is not available, and the caller should fall back to
+// receive_from
+bool udp_socket::read_batch(udp::socket* s)
+{
+	mmsghdr msgs[read_batch_size];
+	iovec iov[read_batch_size];
+	udp::endpoint eps[read_batch_size];
+
+	m_reading_batch = true;
+	while (!m_abort)
+	{
+		for (int i = 0; i < read_batch_size; ++i)
+		{
+			iov[i].iov_base = m_buf + i * m_buf_size;
+			iov[i].iov_len = m_buf_size;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = eps[i].data();
+			msgs[i].msg_hdr.msg_namelen = eps[i].capacity();
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int ret = recvmmsg(s->native_handle(), msgs, read_batch_size, MSG_DONTWAIT, 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			if (errno == ENOSYS)
+			{
+				m_use_mmsg = false;
+				m_reading_batch = false;
+				return false;
+			}
+			udp::endpoint ep;
+			on_read_impl(s, ep, error_code(errno, get_posix_category()), m_buf, 0);
+			break;
+		}
+
+		for (int i = 0; i < ret && !m_abort; ++i)
+		{
+			eps[i].resize(msgs[i].msg_hdr.msg_namelen);
+			on_read_impl(s, eps[i], error_code(), m_buf + i * m_buf_size, msgs[i].msg_len);
+		}
+		if (ret < read_batch_size) break;
+	}
+	m_reading_batch = false;
+
+	if (m_new_buf_size != m_buf_size)
+		set_buf_size(m_new_buf_size);
+	return true;
+}
+
+void udp_socket::queue_send_batch(udp::endpoint const& ep, char const* p, int len)
+{
+	batched_packet bp;
+	bp.ep = ep;
+	bp.offset = int(m_send_batch_buf.size());
+	bp.len = len;
+	m_send_batch_buf.insert(m_send_batch_buf.end(), p, p + len);
+	m_send_batch.push_back(bp);
+
+	if (int(m_send_batch.size()) >= send_batch_size)
+	{
+		flush_send_batch();
+		return;
+	}
+
+	// packets queued outside of on_read (timers, refreshes) are
+	// flushed once the current handler returns
+	if (!m_send_batch_posted)
+	{
+		m_send_batch_posted = true;
+		get_io_service().post(boost::bind(&udp_socket::on_flush_send_batch, this));
+	}
+}
+
+void udp_socket::on_flush_send_batch()
+{
+	m_send_batch_posted = false;
+	flush_send_batch();
+}
+
+void udp_socket::flush_send_batch()
+{
+	if (m_send_batch.empty()) return;
+
+	if (m_abort || !is_open())
+	{
+		m_send_batch.clear();
+		m_send_batch_buf.clear();
+		return;
+	}
+
+	mmsghdr msgs[send_batch_size];
+	iovec iov[send_batch_size];
+	int index[send_batch_size];
+
+	// v4 and v6 packets go out through different sockets
+	for (int family = 0; family < 2; ++family)
+	{
+		udp::socket* sock = &m_ipv4_sock;
+#if TORRENT_USE_IPV6
+		if (family == 1) sock = &m_ipv6_sock;
+#else
+		if (family == 1) break;
+#endif
+
+		int n = 0;
+		for (int i = 0; i < int(m_send_batch.size()); ++i)
+		{
+			batched_packet const& bp = m_send_batch[i];
+#if TORRENT_USE_IPV6
+			bool v6 = bp.ep.address().is_v6() && m_ipv6_sock.is_open();
+			if (v6 != (family == 1)) continue;
+#endif
+			iov[n].iov_base = &m_send_batch_buf[bp.offset];
+			iov[n].iov_len = bp.len;
+			memset(&msgs[n], 0, sizeof(msgs[n]));
+			msgs[n].msg_hdr.msg_name = const_cast<sockaddr*>(bp.ep.data());
+			msgs[n].msg_hdr.msg_namelen = bp.ep.size();
+			msgs[n].msg_hdr.msg_iov = &iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			index[n++] = i;
+		}
+		if (n == 0) continue;
+
+		int sent = 0;
+		while (sent < n)
+		{
+			int ret = sendmmsg(sock->native_handle(), msgs + sent, n - sent, MSG_DONTWAIT);
+			if (ret < 0 && errno == EINTR) continue;
+			if (ret <= 0)
+			{
+				if (ret < 0 && errno == ENOSYS) m_use_mmsg = false;
+				break;
+			}
+			sent += ret;
+		}
+
+		// whatever the kernel didn't take goes through the regular
+		// path, which subscribes to writability on EWOULDBLOCK
+		for (int j = sent; j < n; ++j)
+		{
+			batched_packet const& bp = m_send_batch[index[j]];
+			error_code ec;
+			udp_socket::send(bp.ep, &m_send_batch_buf[bp.offset], bp.len, ec, 0);
+		}
+	}
+
+	m_send_batch.clear();
+	m_send_batch_buf.clear();
+}
+#endif
+
 void udp_socket::call_handler(error_code const& ec, udp::endpoint const& ep, char const* buf, int size)
 {
 	m_observers_locked = true;
@@ -405,7 +586,7 @@ void udp_socket::unsubscribe(udp_socket_observer* o)
 }
 
 void udp_socket::on_read_impl(udp::socket* s, udp::endpoint const& ep
-	, error_code const& e, std::size_t bytes_transferred)
+	, error_code const& e, char const* buf, std::size_t bytes_transferred)
 {
 	TORRENT_ASSERT(m_magic == 0x1337);
 	TORRENT_ASSERT(is_single_thread());
@@ -449,11 +630,11 @@ void udp_socket::on_read_impl(udp::socket* s, udp::endpoint const& ep
 		{
 			// if the source IP doesn't match the proxy's, ignore the packet
 			if (ep == m_udp_proxy_addr)
-				unwrap(e, m_buf, bytes_transferred);
+				unwrap(e, buf, bytes_transferred);
 		}
 		else if (!m_force_proxy) // block incoming packets that aren't coming via the proxy
 		{
-			call_handler(e, ep, m_buf, bytes_transferred);
+			call_handler(e, ep, buf, bytes_transferred);
 		}
 
 	} TORRENT_CATCH (std::exception&) {}
@@ -588,6 +769,10 @@ void udp_socket::close()
 	TORRENT_ASSERT(is_single_thread());
 	TORRENT_ASSERT(m_magic == 0x1337);
 
+#if TORRENT_USE_MMSG
+	flush_send_batch();
+#endif
+
 	error_code ec;
 	// if we close the socket here, we can't shut down
 	// utp connections or NAT-PMP. We need to cancel the
@@ -641,7 +826,11 @@ void udp_socket::set_buf_size(int s)
 {
 	TORRENT_ASSERT(is_single_thread());
 
-	if (m_observers_locked)
+	if (m_observers_locked
+#if TORRENT_USE_MMSG
+		|| m_reading_batch
+#endif
+		)
 	{
 		// we can't actually reallocate the buffer while
 		// it's being used by the observers, we have to
@@ -653,7 +842,7 @@ void udp_socket::set_buf_size(int s)
 	if (s == m_buf_size) return;
 
 	bool no_mem = false;
-	void* tmp = realloc(m_buf, s);
+	void* tmp = realloc(m_buf, s * read_batch_size);
 	if (tmp != 0)
 	{
 		m_buf = (char*)tmp;
@@ -58,6 +58,16 @@ struct mock_socket : udp_socket_interface
 		g_responses.push_back(std::make_pair(ep, msg));
 		return true;
 	}
+	bool send_reply(std::string const& t, char const* r, int len
+		, udp::endpoint const& ep, int flags)
+	{
+		entry msg;
+		msg["z"] = "r";
+		msg["t"] = t;
+		msg["r"] = bdecode(r, r + len);
+		g_responses.push_back(std::make_pair(ep, msg));
+		return true;
+	}
 };
 
 address rand_v4()
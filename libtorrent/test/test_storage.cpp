@@ -902,6 +902,87 @@ void run_test(std::string const& test_path, bool unbuffered)
 	test_check_files(test_path, storage_mode_compact, unbuffered);
 }
 
+void on_read_check(int ret, disk_io_job const& j, char const* data, int size, bool* done)
+{
+	std::cerr << "on_read_check piece: " << j.piece << std::endl;
+	if (data)
+	{
+		TEST_EQUAL(ret, size);
+		if (ret > 0) TEST_CHECK(std::equal(j.buffer, j.buffer + ret, data));
+	}
+	*done = true;
+}
+
+void write_block(disk_io_thread& io, boost::intrusive_ptr<piece_manager>& pm
+	, io_service& ios, int piece, char const* data)
+{
+	peer_request r;
+	r.piece = piece;
+	r.start = 0;
+	r.length = block_size;
+	disk_buffer_holder holder(io, io.allocate_buffer("test"));
+	std::memcpy(holder.get(), data, block_size);
+	bool done = false;
+	pm->async_write(r, holder, boost::bind(&signal_bool, &done, "async_write"));
+	run_until(ios, done);
+}
+
+// [MF] a piece written again must not be served from a read cache filled
+// with the old content, not even by a read issued before the new content
+// is flushed
+void test_rewrite_read_cache(std::string const& test_path)
+{
+	std::cerr << "\n=== test rewrite read cache ===\n" << std::endl;
+
+	file_storage fs;
+	fs.add_file("temp_storage/test1.tmp", 3 * piece_size);
+	libtorrent::create_torrent t(fs, piece_size, -1, 0);
+	std::vector<char> buf;
+	bencode(std::back_inserter(buf), t.generate());
+	error_code ec;
+	boost::intrusive_ptr<torrent_info> info(new torrent_info(&buf[0], buf.size(), ec));
+
+	CLevelDB db(combine_path(test_path, "temp_db"), 1 << 20, true);
+	file_pool fp;
+	libtorrent::asio::io_service ios;
+	disk_io_thread io(ios, boost::function<void()>(), fp);
+	boost::shared_ptr<int> dummy(new int);
+	boost::intrusive_ptr<piece_manager> pm = new piece_manager(dummy, info
+		, test_path, db, io, default_storage_constructor, storage_mode_sparse
+		, std::vector<boost::uint8_t>());
+
+	peer_request r;
+	r.piece = 0;
+	r.start = 0;
+	r.length = block_size;
+	bool done = false;
+
+	// piece0 is written, flushed and read into the read cache
+	write_block(io, pm, ios, 0, piece0);
+	pm->async_hash(0, boost::bind(&signal_bool, &done, "async_hash"));
+	run_until(ios, done);
+	done = false;
+	pm->async_read(r, boost::bind(&on_read_check, _1, _2, piece0, block_size, &done));
+	run_until(ios, done);
+
+	// piece1 replaces it. read it before the write cache is flushed, this
+	// one may still see piece0 but must not cache it
+	write_block(io, pm, ios, 0, piece1);
+	done = false;
+	pm->async_read(r, boost::bind(&on_read_check, _1, _2, (char const*)0, block_size, &done));
+	run_until(ios, done);
+	done = false;
+	pm->async_hash(0, boost::bind(&signal_bool, &done, "async_hash"));
+	run_until(ios, done);
+
+	done = false;
+	pm->async_read(r, boost::bind(&on_read_check, _1, _2, piece1, block_size, &done));
+	run_until(ios, done);
+
+	io.abort();
+	io.join();
+}
+
 void test_fastresume(std::string const& test_path)
 {
 	error_code ec;
@@ -1126,6 +1207,7 @@ int test_main()
 
 	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_fastresume, _1));
 	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_rename_file_in_fastresume, _1));
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_rewrite_read_cache, _1));
 	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&run_test, _1, true));
 	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&run_test, _1, false));
 
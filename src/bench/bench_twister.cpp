@@ -0,0 +1,533 @@
+// Micro-benchmarks for twister hot paths.
+//
+// A throw-away regtest chain is mined at startup holding a generated set of
+// registered users (their keys are kept in a mock wallet), so signature
+// checks, post acceptance, swarm storage and the DHT store path all run
+// against the real code. Results are written to stdout as a JSON array with
+// one object per benchmark; everything else goes to debug.log in the
+// temporary data directory.
+//
+// usage: bench_twister [-users=<n>] [-posts=<n>] [-following=<n>]
+//                      [-iterations=<n>] [-filter=<substring>] [-port=<n>]
+
+#include "db.h"
+#include "txdb.h"
+#include "main.h"
+#include "wallet.h"
+#include "init.h"
+#include "util.h"
+#include "ui_interface.h"
+#include "bitcoinrpc.h"
+#include "chainparams.h"
+#include "twister.h"
+
+#include "libtorrent/entry.hpp"
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/lazy_entry.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/torrent_handle.hpp"
+#include "libtorrent/kademlia/node.hpp"
+#include "libtorrent/kademlia/node_id.hpp"
+
+#include <openssl/rand.h>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+
+using namespace json_spirit;
+using namespace std;
+using namespace libtorrent;
+
+CWallet* pwalletMain;
+CClientUIInterface uiInterface;
+
+extern void noui_connect();
+
+void StartShutdown()
+{
+    exit(0);
+}
+
+bool ShutdownRequested()
+{
+    return false;
+}
+
+void Shutdown()
+{
+}
+
+struct BenchUser
+{
+    std::string strUsername;
+    CKey key;
+};
+
+static std::vector<BenchUser> vUsers;
+static Array vResults;
+
+static bool BenchEnabled(const std::string &name)
+{
+    std::string strFilter = GetArg("-filter", "");
+    return strFilter.empty() || name.find(strFilter) != std::string::npos;
+}
+
+static void ReportBench(const std::string &name, int nIterations, int64 nMicros,
+                        const Object &extra = Object())
+{
+    Object obj;
+    obj.push_back(Pair("name", name));
+    obj.push_back(Pair("iterations", nIterations));
+    obj.push_back(Pair("total_ms", nMicros / 1000.0));
+    obj.push_back(Pair("us_per_op", nIterations ? (double)nMicros / nIterations : 0.0));
+    obj.push_back(Pair("ops_per_sec", nMicros ? nIterations * 1000000.0 / nMicros : 0.0));
+    BOOST_FOREACH(const Pair &p, extra)
+        obj.push_back(p);
+    vResults.push_back(obj);
+}
+
+//
+// Local stand-in for the block chain
+//
+
+static bool MineBenchBlock()
+{
+    std::vector<unsigned char> salt(4);
+    RAND_bytes(&salt[0], salt.size());
+
+    auto_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(salt));
+    if (!pblocktemplate.get())
+        return error("MineBenchBlock: CreateNewBlock failed");
+    CBlock *pblock = &pblocktemplate->block;
+
+    unsigned int nExtraNonce = 0;
+    IncrementExtraNonce(pblock, pindexBest, nExtraNonce);
+    // many blocks are mined within the same second: keep ahead of the median time
+    pblock->nTime = std::max(pindexBest->GetMedianTimePast() + 1, GetAdjustedTime());
+    while (!CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits))
+        pblock->nNonce++;
+
+    CValidationState state;
+    LOCK(cs_main);
+    if (!ProcessBlock(state, NULL, pblock))
+        return error("MineBenchBlock: ProcessBlock rejected block");
+    return true;
+}
+
+static bool RegisterBenchUsers(int nUsers, int nPostsPerUser)
+{
+    for (int i = 0; i < nUsers; i++) {
+        BenchUser user;
+        user.strUsername = strprintf("bench%d", i);
+        user.key.MakeNewKey(true);
+        CPubKey pubkey = user.key.GetPubKey();
+
+        {
+            LOCK(pwalletMain->cs_wallet);
+            pwalletMain->mapKeyMetadata[pubkey.GetID()] = CKeyMetadata(GetTime(), user.strUsername);
+            if (!pwalletMain->AddKeyPubKey(user.key, pubkey))
+                return error("RegisterBenchUsers: AddKeyPubKey failed for %s", user.strUsername.c_str());
+        }
+
+        CTransaction tx;
+        tx.userName = CScript() << std::vector<unsigned char>(user.strUsername.begin(), user.strUsername.end());
+        tx.pubKey << std::vector<unsigned char>(pubkey.begin(), pubkey.end());
+        if (!DoTxProofOfWork(tx))
+            return false;
+
+        CValidationState state;
+        if (!mempool.accept(state, tx, false, NULL))
+            return error("RegisterBenchUsers: mempool rejected %s", user.strUsername.c_str());
+        vUsers.push_back(user);
+    }
+
+    while (mempool.size()) {
+        if (!MineBenchBlock())
+            return false;
+    }
+
+    // validatePostNumberForUser allows 2 posts per block since registration (+20)
+    for (int i = 0; i < nPostsPerUser / 2 - 9; i++) {
+        if (!MineBenchBlock())
+            return false;
+    }
+    return true;
+}
+
+//
+// Fixtures
+//
+
+static std::string SignBenchMessage(const BenchUser &user, const std::string &strMessage)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << strMessageMagic;
+    ss << strMessage;
+
+    std::vector<unsigned char> vchSig;
+    user.key.SignCompact(ss.GetHash(), vchSig);
+    return std::string((const char *)&vchSig[0], vchSig.size());
+}
+
+static std::string BenchPostText(int i, int k)
+{
+    return strprintf("benchword post %d from user %d #benchtag @bench%d", k, i, (i + 1) % (int)vUsers.size());
+}
+
+// bencoded signed posts, indexed by [user][k-1]
+static std::vector< std::vector<std::string> > vvPosts;
+
+static bool CreateBenchPosts(int nPostsPerUser)
+{
+    vvPosts.resize(vUsers.size());
+    for (unsigned int i = 0; i < vUsers.size(); i++) {
+        for (int k = 1; k <= nPostsPerUser; k++) {
+            entry v;
+            if (!createSignedUserpost(v, vUsers[i].strUsername, k, BenchPostText(i, k),
+                                      NULL, NULL, NULL, std::string(), 0))
+                return error("CreateBenchPosts: createSignedUserpost failed");
+            std::vector<char> buf;
+            bencode(std::back_inserter(buf), v);
+            vvPosts[i].push_back(std::string(buf.data(), buf.size()));
+        }
+    }
+    return true;
+}
+
+//
+// Benchmarks not requiring the libtorrent session
+//
+
+static void BenchVerifySignature(int nIterations)
+{
+    std::vector<std::string> vMessages, vSigs;
+    for (unsigned int i = 0; i < vUsers.size(); i++) {
+        std::string strMessage = BenchPostText(i, 0);
+        vMessages.push_back(strMessage);
+        vSigs.push_back(SignBenchMessage(vUsers[i], strMessage));
+    }
+
+    int nFailures = 0;
+    int64 nStart = GetTimeMicros();
+    for (int n = 0; n < nIterations; n++) {
+        unsigned int i = n % vUsers.size();
+        if (!verifySignature(vMessages[i], vUsers[i].strUsername, vSigs[i]))
+            nFailures++;
+    }
+    int64 nElapsed = GetTimeMicros() - nStart;
+
+    Object extra;
+    extra.push_back(Pair("users", (int)vUsers.size()));
+    extra.push_back(Pair("failures", nFailures));
+    ReportBench("verify_signature", nIterations, nElapsed, extra);
+}
+
+static void BenchAcceptSignedPost()
+{
+    int nIterations = 0, nFailures = 0;
+    int64 nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < vvPosts.size(); i++) {
+        for (unsigned int k = 0; k < vvPosts[i].size(); k++) {
+            std::string errmsg;
+            boost::uint32_t flags;
+            if (!acceptSignedPost(vvPosts[i][k].data(), vvPosts[i][k].size(),
+                                  vUsers[i].strUsername, k + 1, errmsg, &flags))
+                nFailures++;
+            nIterations++;
+        }
+    }
+    int64 nElapsed = GetTimeMicros() - nStart;
+
+    Object extra;
+    extra.push_back(Pair("failures", nFailures));
+    ReportBench("accept_signed_post", nIterations, nElapsed, extra);
+}
+
+struct BenchUdpSocket : dht::udp_socket_interface
+{
+    int nReplies;
+    int nErrors;
+
+    BenchUdpSocket() : nReplies(0), nErrors(0) {}
+
+    bool send_packet(entry& e, udp::endpoint const& addr, int flags)
+    {
+        nReplies++;
+        if (e.find_key("e"))
+            nErrors++;
+        return true;
+    }
+
+    // streamed replies are never errors, those go through send_packet
+    bool send_reply(std::string const& t, char const* r, int len,
+                    udp::endpoint const& addr, int flags)
+    {
+        nReplies++;
+        return true;
+    }
+};
+
+static std::string BenchPutDataRequest(dht::node_impl &node, udp::endpoint const &ep,
+                                       const BenchUser &user, std::string const &username,
+                                       std::string const &resource, bool multi, entry const &value)
+{
+    entry p;
+    entry& target = p["target"];
+    target["n"] = username;
+    target["r"] = resource;
+    target["t"] = (multi) ? "m" : "s";
+    if (!multi) p["seq"] = 1;
+    p["v"] = value;
+    p["time"] = GetAdjustedTime();
+    p["height"] = getBestHeight() - 1;
+
+    std::vector<char> buf;
+    bencode(std::back_inserter(buf), target);
+    sha1_hash targetHash = hasher(buf.data(), buf.size()).final();
+
+    buf.clear();
+    bencode(std::back_inserter(buf), p);
+    std::string str_p(buf.data(), buf.size());
+
+    entry req;
+    req["z"] = "q";
+    req["t"] = "bt";
+    req["q"] = "putData";
+    entry& a = req["x"];
+    a["id"] = dht::generate_id(ep.address()).to_string();
+    a["token"] = node.generate_token(ep, (char const*)&targetHash[0]);
+    a["sig_p"] = SignBenchMessage(user, str_p);
+    a["sig_user"] = user.strUsername;
+    a["p"] = p;
+
+    buf.clear();
+    bencode(std::back_inserter(buf), req);
+    return std::string(buf.data(), buf.size());
+}
+
+static void BenchDhtStore(int nIterations)
+{
+    BenchUdpSocket sock;
+    dht_settings settings;
+    dht::node_impl node(NULL, &sock, settings, dht::node_id(),
+                        address_v4::from_string("127.0.0.1"), NULL);
+    udp::endpoint ep(address_v4::from_string("10.0.0.2"), 4433);
+
+    // one single item (profile) per user, plus one multi item per user
+    // stored under a common hashtag to exercise the per-target lists.
+    std::vector<std::string> vRequests;
+    for (unsigned int i = 0; i < vUsers.size(); i++) {
+        entry profile;
+        profile["fullname"] = vUsers[i].strUsername;
+        profile["bio"] = BenchPostText(i, 0);
+        vRequests.push_back(BenchPutDataRequest(node, ep, vUsers[i], vUsers[i].strUsername,
+                                                "profile", false, profile));
+
+        entry tag;
+        tag["userpost"]["n"] = vUsers[i].strUsername;
+        tag["userpost"]["msg"] = BenchPostText(i, 0);
+        vRequests.push_back(BenchPutDataRequest(node, ep, vUsers[i], "benchtag",
+                                                "hashtag", true, tag));
+    }
+
+    int64 nStart = GetTimeMicros();
+    BOOST_FOREACH(const std::string &strRequest, vRequests) {
+        lazy_entry e;
+        libtorrent::error_code ec;
+        int pos;
+        if (lazy_bdecode(strRequest.data(), strRequest.data() + strRequest.size(), e, ec, &pos) != 0)
+            continue;
+        node.incoming(dht::msg(e, ep));
+    }
+    int64 nElapsed = GetTimeMicros() - nStart;
+
+    Object extra;
+    extra.push_back(Pair("errors", sock.nErrors));
+    if (BenchEnabled("dht_store_putdata"))
+        ReportBench("dht_store_putdata", vRequests.size(), nElapsed, extra);
+
+    if (!BenchEnabled("dht_refresh_storage"))
+        return;
+
+    nStart = GetTimeMicros();
+    for (int n = 0; n < nIterations; n++)
+        node.refresh_storage();
+    nElapsed = GetTimeMicros() - nStart;
+
+    extra.clear();
+    extra.push_back(Pair("stored_items", (int)vRequests.size()));
+    ReportBench("dht_refresh_storage", nIterations, nElapsed, extra);
+}
+
+//
+// Benchmarks over the libtorrent session and the swarm leveldb
+//
+
+static bool WaitForSession(const std::string &strUsername)
+{
+    for (int i = 0; i < 120; i++) {
+        if (startTorrentUser(strUsername, true).is_valid())
+            return true;
+        MilliSleep(500);
+    }
+    return error("WaitForSession: libtorrent session did not start");
+}
+
+static void BenchSwarm(int nIterations, int nFollowing)
+{
+    int nPostsPerUser = vvPosts.size() ? vvPosts[0].size() : 0;
+    int nUsers = std::min((int)vUsers.size(), nFollowing);
+
+    Array followed;
+    for (int i = 0; i < nUsers; i++)
+        followed.push_back(vUsers[i].strUsername);
+    Array params;
+    params.push_back(vUsers[0].strUsername);
+    params.push_back(followed);
+
+    int64 nStart = GetTimeMicros();
+    follow(params, false);
+    int64 nElapsed = GetTimeMicros() - nStart;
+    ReportBench("follow_start_torrent", nUsers, nElapsed);
+
+    // add_piece is asynchronous: include the time until all pieces are on disk
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nUsers; i++) {
+        torrent_handle h = getTorrentUser(vUsers[i].strUsername);
+        for (unsigned int k = 0; k < vvPosts[i].size(); k++)
+            h.add_piece(k + 1, vvPosts[i][k].data(), vvPosts[i][k].size());
+    }
+    int nStored = 0;
+    for (int wait = 0; wait < 600; wait++) {
+        nStored = 0;
+        for (int i = 0; i < nUsers; i++)
+            nStored += getTorrentUser(vUsers[i].strUsername).status().num_pieces;
+        if (nStored >= nUsers * nPostsPerUser)
+            break;
+        MilliSleep(10);
+    }
+    nElapsed = GetTimeMicros() - nStart;
+
+    Object extra;
+    extra.push_back(Pair("stored", nStored));
+    ReportBench("swarm_add_piece", nUsers * nPostsPerUser, nElapsed, extra);
+
+    if (BenchEnabled("torrent_get_pieces")) {
+        int nPieces = 0;
+        nStart = GetTimeMicros();
+        for (int n = 0; n < nIterations; n++) {
+            std::vector<std::string> pieces;
+            getTorrentUser(vUsers[n % nUsers].strUsername).get_pieces(pieces, nPostsPerUser,
+                std::numeric_limits<int>::max(), -1, ~USERPOST_FLAG_DM);
+            nPieces += pieces.size();
+        }
+        nElapsed = GetTimeMicros() - nStart;
+
+        extra.clear();
+        extra.push_back(Pair("pieces", nPieces));
+        ReportBench("torrent_get_pieces", nIterations, nElapsed, extra);
+    }
+
+    if (BenchEnabled("getposts")) {
+        Array users;
+        for (int i = 0; i < nUsers; i++) {
+            Object user;
+            user.push_back(Pair("username", vUsers[i].strUsername));
+            users.push_back(user);
+        }
+        params.clear();
+        params.push_back(20);
+        params.push_back(users);
+
+        int nRounds = std::max(1, nIterations / nUsers);
+        nStart = GetTimeMicros();
+        for (int n = 0; n < nRounds; n++)
+            getposts(params, false);
+        nElapsed = GetTimeMicros() - nStart;
+
+        extra.clear();
+        extra.push_back(Pair("following", nUsers));
+        ReportBench("getposts", nRounds, nElapsed, extra);
+    }
+
+    if (BenchEnabled("search_messages")) {
+        params.clear();
+        params.push_back("messages");
+        params.push_back("benchword");
+        params.push_back(20);
+
+        int nRounds = std::max(1, nIterations / nUsers);
+        nStart = GetTimeMicros();
+        for (int n = 0; n < nRounds; n++)
+            search(params, false);
+        nElapsed = GetTimeMicros() - nStart;
+
+        extra.clear();
+        extra.push_back(Pair("posts", nUsers * nPostsPerUser));
+        ReportBench("search_messages", nRounds, nElapsed, extra);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    ParseParameters(argc, argv);
+    int nUsers       = std::max((int64)2, GetArg("-users", 200));
+    int nPosts       = std::max((int64)1, GetArg("-posts", 10));
+    int nFollowing   = std::max((int64)1, GetArg("-following", 50));
+    int nIterations  = std::max((int64)1, GetArg("-iterations", 1000));
+
+    SelectParams(CChainParams::REGTEST);
+    noui_connect();
+    bitdb.MakeMock();
+    boost::filesystem::path pathTemp = GetTempPath() / strprintf("bench_twister_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+    SoftSetBoolArg("-upnp", false);
+
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    CCoinsViewDB *pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+    pcoinsTip = new CCoinsViewCache(*pcoinsdbview);
+    InitBlockIndex();
+    bool fFirstRun;
+    pwalletMain = new CWallet("wallet.dat");
+    pwalletMain->LoadWallet(fFirstRun);
+    RegisterWallet(pwalletMain);
+
+    boost::thread_group threadGroup;
+    int ret = 1;
+
+    if (RegisterBenchUsers(nUsers, nPosts) && CreateBenchPosts(nPosts)) {
+        if (BenchEnabled("verify_signature"))
+            BenchVerifySignature(nIterations);
+        if (BenchEnabled("accept_signed_post"))
+            BenchAcceptSignedPost();
+        if (BenchEnabled("dht_store_putdata") || BenchEnabled("dht_refresh_storage"))
+            BenchDhtStore(nIterations);
+        ret = 0;
+
+        // the swarm benchmarks share the follow/add_piece setup
+        if (BenchEnabled("follow_start_torrent") || BenchEnabled("swarm_add_piece") ||
+            BenchEnabled("torrent_get_pieces") || BenchEnabled("getposts") ||
+            BenchEnabled("search_messages")) {
+            startSessionTorrent(threadGroup);
+            if (WaitForSession(vUsers[0].strUsername))
+                BenchSwarm(nIterations, nFollowing);
+            else
+                ret = 1;
+            stopSessionTorrent();
+        }
+    }
+
+    fputs(write_string(Value(vResults), true).c_str(), stdout);
+    fputs("\n", stdout);
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    delete pwalletMain;
+    pwalletMain = NULL;
+    delete pcoinsTip;
+    delete pcoinsdbview;
+    delete pblocktree;
+    bitdb.Flush(true);
+    boost::filesystem::remove_all(pathTemp);
+    return ret;
+}
@@ -207,6 +207,7 @@ static const CRPCCommand vRPCCommands[] =
     { "addnode",                &addnode,                true,      true,       false },
     { "adddnsseed",             &adddnsseed,             true,      true,       false },
     { "getaddednodeinfo",       &getaddednodeinfo,       true,      true,       false },
+    { "getmemoryinfo",          &getmemoryinfo,          true,      true,       false },
     { "getdifficulty",          &getdifficulty,          true,      false,      false },
     { "getgenerate",            &getgenerate,            true,      false,      false },
     { "setgenerate",            &setgenerate,            true,      false,      false },
@@ -1295,6 +1296,7 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "importprivkey"          && n > 3) ConvertTo<bool>(params[3]);
     if (strMethod == "verifychain"            && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "verifychain"            && n > 1) ConvertTo<boost::int64_t>(params[1]);
+    if (strMethod == "getmemoryinfo"          && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "dhtput"                 && n > 3) ConvertToValue(params[3]);
     if (strMethod == "dhtput"                 && n > 5) ConvertTo<boost::int64_t>(params[5]);
     if (strMethod == "dhtget"                 && n > 3) ConvertTo<boost::int64_t>(params[3]);
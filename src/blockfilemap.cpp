@@ -0,0 +1,80 @@
+#include "blockfilemap.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CBlockFileMap blockFileMap(MAX_MAPPED_BLOCKFILES);
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap((void*)pbegin, nSize);
+#endif
+}
+
+// map the whole file as it is now, NULL on failure
+static CMappedFile *MapBlockFile(int nFile)
+{
+#ifdef WIN32
+    return NULL;
+#else
+    boost::filesystem::path path = GetDataDir() / "blocks" / strprintf("blk%05u.dat", nFile);
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("MapBlockFile() : mmap of %s failed\n", path.string().c_str());
+        return NULL;
+    }
+    return new CMappedFile((const char*)p, st.st_size);
+#endif
+}
+
+boost::shared_ptr<CMappedFile> CBlockFileMap::Get(int nFile, size_t nMinSize)
+{
+    LOCK(cs);
+    std::map<int, std::pair<boost::shared_ptr<CMappedFile>, int64> >::iterator mi = mapFiles.find(nFile);
+    if (mi != mapFiles.end() && mi->second.first->size() >= nMinSize) {
+        mi->second.second = ++nUseCounter;
+        return mi->second.first;
+    }
+
+    boost::shared_ptr<CMappedFile> mapped(MapBlockFile(nFile));
+    if (!mapped || mapped->size() < nMinSize)
+        return boost::shared_ptr<CMappedFile>();
+
+    if (mi == mapFiles.end() && mapFiles.size() >= nMaxFiles) {
+        // drop the least recently used one
+        std::map<int, std::pair<boost::shared_ptr<CMappedFile>, int64> >::iterator oldest = mapFiles.begin();
+        for (std::map<int, std::pair<boost::shared_ptr<CMappedFile>, int64> >::iterator it = mapFiles.begin(); it != mapFiles.end(); ++it)
+            if (it->second.second < oldest->second.second)
+                oldest = it;
+        mapFiles.erase(oldest);
+    }
+    mapFiles[nFile] = std::make_pair(mapped, ++nUseCounter);
+    return mapped;
+}
+
+void CBlockFileMap::Invalidate(int nFile)
+{
+    LOCK(cs);
+    mapFiles.erase(nFile);
+}
+
+void CBlockFileMap::Clear()
+{
+    LOCK(cs);
+    mapFiles.clear();
+}
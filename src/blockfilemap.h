@@ -0,0 +1,62 @@
+#ifndef BLOCKFILEMAP_H
+#define BLOCKFILEMAP_H
+
+#include "sync.h"
+#include "util.h"
+
+#include <map>
+#include <boost/shared_ptr.hpp>
+
+// Read-only memory mappings of the blk?????.dat files.
+//
+// Blocks and transactions are deserialized straight from the mapping
+// (CSpanStream), without an fopen/fseek/fread per lookup. A few recently used
+// files are kept mapped; a mapping stays valid while a reader holds it, even
+// if it is dropped from the pool meanwhile. Where files can't be mapped
+// (windows, out of address space) Get returns NULL and callers fall back to
+// OpenBlockFile.
+
+// number of block files kept mapped (128 MiB of address space each)
+static const unsigned int MAX_MAPPED_BLOCKFILES = 8;
+
+class CMappedFile
+{
+public:
+    CMappedFile(const char *pbeginIn, size_t nSizeIn) : pbegin(pbeginIn), nSize(nSizeIn) {}
+    ~CMappedFile();
+
+    const char *begin() const { return pbegin; }
+    const char *end() const   { return pbegin + nSize; }
+    size_t size() const       { return nSize; }
+
+private:
+    const char *pbegin;
+    size_t nSize;
+
+    CMappedFile(const CMappedFile &);
+    CMappedFile &operator=(const CMappedFile &);
+};
+
+class CBlockFileMap
+{
+public:
+    CBlockFileMap(unsigned int nMaxFilesIn) : nMaxFiles(nMaxFilesIn), nUseCounter(0) {}
+
+    // mapping of block file nFile at least nMinSize bytes long. a shorter
+    // mapping is replaced, the file may have grown since it was made.
+    boost::shared_ptr<CMappedFile> Get(int nFile, size_t nMinSize);
+    // to be called before nFile is truncated
+    void Invalidate(int nFile);
+    void Clear();
+
+private:
+    CCriticalSection cs;
+    unsigned int nMaxFiles;
+    int64 nUseCounter;
+    // nFile -> (mapping, last use)
+    std::map<int, std::pair<boost::shared_ptr<CMappedFile>, int64> > mapFiles;
+};
+
+extern CBlockFileMap blockFileMap;
+
+#endif // BLOCKFILEMAP_H
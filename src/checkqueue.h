@@ -7,6 +7,7 @@
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/condition_variable.hpp>
+#include <boost/foreach.hpp>
 
 #include <vector>
 #include <algorithm>
@@ -99,7 +100,6 @@ private:
                 // * Try to account for idle jobs which will instantly start helping.
                 // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
                 nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                /* [MF]
                 vChecks.resize(nNow);
                 for (unsigned int i = 0; i < nNow; i++) {
                      // We want the lock on the mutex to be as short as possible, so swap jobs from the global
@@ -107,17 +107,14 @@ private:
                      vChecks[i].swap(queue.back());
                      queue.pop_back();
                 }
-                */
                 // Check whether we need to do work at all
                 fOk = fAllOk;
             }
             // execute work
-          /*
             BOOST_FOREACH(T &check, vChecks)
                 if (fOk)
                     fOk = check();
             vChecks.clear();
-            */
         } while(true);
     }
 
@@ -35,13 +35,29 @@ namespace DhtProxy
 
     class PeerBanStats {
       public:
-        PeerBanStats() : active(0), count(0), limit(time_now()) {}
-        int active;
+        PeerBanStats() : count(0), limit(time_now()) {}
+        // lookups started on behalf of this peer (requests answered from
+        // the cache or joining a lookup in flight don't count)
+        std::set<sha1_hash> active;
         int count;
         ptime limit;
     };
     map<CService, PeerBanStats> m_peerBanStats;
     size_t numProxiesToUse = 4;
+
+    // replies of lookups started on behalf of our clients (server side)
+    class CachedDhtGet {
+      public:
+        CachedDhtGet() : nTime(GetTime()) {}
+        int64 nTime;
+        std::vector<CDHTGetReply> vReplies;
+    };
+    map<sha1_hash, CachedDhtGet> m_dhtgetCache;
+    const int64 dhtgetCacheTime = 60;
+    const size_t dhtgetCacheMaxSize = 5000;
+    // max lookups started for a single peer, a batch may need them all at once
+    const size_t dhtgetMaxActive = 10;
+    const size_t dhtgetMaxActiveBatch = MAX_DHTGET_BATCH_SIZE;
     
     void dhtgetMapAdd(sha1_hash &ih, alert_manager *am)
     {
@@ -133,12 +149,134 @@ namespace DhtProxy
             pnode->Release();
         }
     }
+
+    void pushRequests(CNode *pnode, std::vector<CDHTGetRequest> const &vReq)
+    {
+        if( pnode->nVersion >= DHT_PROXY_BATCH_VERSION ) {
+            for( size_t i = 0; i < vReq.size(); i += MAX_DHTGET_BATCH_SIZE ) {
+                std::vector<CDHTGetRequest> vBatch(vReq.begin() + i,
+                                                   vReq.begin() + std::min(vReq.size(), i + MAX_DHTGET_BATCH_SIZE));
+                pnode->PushMessage("dhtgetreqs", vBatch);
+            }
+        } else {
+            BOOST_FOREACH(const CDHTGetRequest &req, vReq) {
+                pnode->PushMessage("dhtgetreq", req);
+            }
+        }
+    }
+
+    std::vector<CDHTGetRequest> makeRequests(std::vector<CDHTTarget> const &vTargets, bool stopReq)
+    {
+        std::vector<CDHTGetRequest> vReq(vTargets.size());
+        for( size_t i = 0; i < vTargets.size(); i++ ) {
+            CDHTTarget &target = vReq[i];
+            target = vTargets[i];
+            vReq[i].stopReq = stopReq;
+        }
+        return vReq;
+    }
+
+    vector<CNode*> dhtgetStartRequest(std::vector<CDHTTarget> const &vTargets)
+    {
+        std::vector<CDHTGetRequest> vReq = makeRequests(vTargets, false);
+
+        LOCK(cs_vNodes);
+        vector<CNode*> vNodesReq = getRandomDhtProxies();
+        BOOST_FOREACH(CNode* pnode, vNodesReq) {
+            dbgprintf("DhtProxy::dhtgetStartRequest: pushMessage %zd targets to %s\n",
+                      vReq.size(), pnode->addr.ToString().c_str());
+            pushRequests(pnode, vReq);
+            pnode->AddRef();
+        }
+        if( !vNodesReq.size() ) {
+            dbgprintf("DhtProxy::dhtgetStartRequest: sorry, no dht proxy found.\n");
+
+            // fake no data to wakeup listeners
+            dht_reply_data_done_alert dd("","",false,false,false);
+            BOOST_FOREACH(const CDHTTarget &target, vTargets) {
+                std::string username(target.vchUsername.data(), target.vchUsername.size());
+                std::string resource(target.vchResource.data(), target.vchResource.size());
+                sha1_hash ih = dhtTargetHash(username, resource, target.resTypeMulti ? "m" : "s");
+                dhtgetMapPost(ih, dd);
+            }
+        }
+        return vNodesReq;
+    }
+
+    void dhtgetStopRequest(vector<CNode*> vNodesReq, std::vector<CDHTTarget> const &vTargets)
+    {
+        std::vector<CDHTGetRequest> vReq = makeRequests(vTargets, true);
+
+        BOOST_FOREACH(CNode* pnode, vNodesReq) {
+            dbgprintf("DhtProxy::dhtgetStopRequest: pushMessage %zd targets to %s\n",
+                      vReq.size(), pnode->addr.ToString().c_str());
+            pushRequests(pnode, vReq);
+            pnode->Release();
+        }
+    }
     
-    void dhtgetPeerReqAdd(sha1_hash &ih, const CNode *pnode)
+    void dhtgetCachePrune()
+    {
+        // (cs_dhtProxy) lock must be held!
+        int64 now = GetTime();
+        std::map<sha1_hash, CachedDhtGet>::iterator oldest = m_dhtgetCache.end();
+        for( std::map<sha1_hash, CachedDhtGet>::iterator mi = m_dhtgetCache.begin(); mi != m_dhtgetCache.end(); ) {
+            if( mi->second.nTime + dhtgetCacheTime < now ) {
+                m_dhtgetCache.erase(mi++);
+            } else {
+                if( oldest == m_dhtgetCache.end() || mi->second.nTime < oldest->second.nTime )
+                    oldest = mi;
+                ++mi;
+            }
+        }
+        if( m_dhtgetCache.size() >= dhtgetCacheMaxSize && oldest != m_dhtgetCache.end() )
+            m_dhtgetCache.erase(oldest);
+    }
+
+    bool isCachedDhtGet(const sha1_hash &ih)
+    {
+        // (cs_dhtProxy) lock must be held!
+        std::map<sha1_hash, CachedDhtGet>::iterator mi = m_dhtgetCache.find(ih);
+        return mi != m_dhtgetCache.end() && mi->second.nTime + dhtgetCacheTime >= GetTime();
+    }
+
+    // register pnode as interested in ih. vReplies receives the replies we already
+    // have for ih (in flight or recent lookup). returns true if a new lookup is needed.
+    // fRefused is set instead if pnode already has too many lookups of its own.
+    bool dhtgetPeerReqAdd(sha1_hash &ih, const CNode *pnode, std::vector<CDHTGetReply> &vReplies, bool &fRefused)
     {
         LOCK(cs_dhtProxy);
+        fRefused = false;
+
+        if( isCachedDhtGet(ih) ) {
+            m_dhtgetPeersReq[ih].push_back(pnode->addr);
+            std::map<sha1_hash, CachedDhtGet>::iterator mi = m_dhtgetCache.find(ih);
+            vReplies.insert(vReplies.end(), mi->second.vReplies.begin(), mi->second.vReplies.end());
+            return false;
+        }
+
+        // lookups whose cache entry expired are over
+        std::set<sha1_hash> &active = m_peerBanStats[pnode->addr].active;
+        for( std::set<sha1_hash>::iterator it = active.begin(); it != active.end(); ) {
+            if( !isCachedDhtGet(*it) )
+                active.erase(it++);
+            else
+                ++it;
+        }
+        size_t maxActive = pnode->nVersion >= DHT_PROXY_BATCH_VERSION ? dhtgetMaxActiveBatch : dhtgetMaxActive;
+        if( active.size() >= maxActive ) {
+            dbgprintf("DhtProxy::dhtgetPeerReqAdd: %s max active requests reached.\n",
+                       pnode->addr.ToString().c_str());
+            fRefused = true;
+            return false;
+        }
+        active.insert(ih);
         m_dhtgetPeersReq[ih].push_back(pnode->addr);
-        m_peerBanStats[pnode->addr].active++;
+
+        if( !m_dhtgetCache.count(ih) && m_dhtgetCache.size() >= dhtgetCacheMaxSize )
+            dhtgetCachePrune();
+        m_dhtgetCache[ih] = CachedDhtGet();
+        return true;
     }
     
     void dhtgetPeerReqRemove(sha1_hash &ih, const CNode *pnode)
@@ -151,8 +289,8 @@ namespace DhtProxy
             if( !addrList.size() ) {
                 m_dhtgetPeersReq.erase(ih);
             }
-            m_peerBanStats[pnode->addr].active--;
         }
+        m_peerBanStats[pnode->addr].active.erase(ih);
     }
     
     void dhtgetPeerReqReply(sha1_hash &ih, const alert *a)
@@ -165,6 +303,11 @@ namespace DhtProxy
         }
     
         LOCK(cs_dhtProxy);
+        std::map<sha1_hash, CachedDhtGet>::iterator ci = m_dhtgetCache.find(ih);
+        if( ci != m_dhtgetCache.end() ) {
+            ci->second.vReplies.push_back(reply);
+        }
+
         std::map<sha1_hash, std::list<CService> >::iterator mi = m_dhtgetPeersReq.find(ih);
         if( mi != m_dhtgetPeersReq.end() ) {
             std::list<CService> &addrList = (*mi).second;
@@ -200,14 +343,36 @@ namespace DhtProxy
             match->count = 0;
             match->limit = now + seconds(5);
         }
-        if( match->active > 10 ) {
-            dbgprintf("DhtProxy::checkForAbuse: %s misbehaving, max active requests reached.\n", 
-                       pfrom->addr.ToString().c_str());
-            return true;
-        }
+        // too many active lookups is not abuse, see dhtgetPeerReqAdd
         return false;
     }
 
+    void processGetRequest(const CDHTGetRequest& req, CNode* pfrom, std::vector<CDHTGetReply> &vReplies)
+    {
+        std::string username(req.vchUsername.data(), req.vchUsername.size());
+        std::string resource(req.vchResource.data(), req.vchResource.size());
+        bool           multi(req.resTypeMulti);
+
+        dbgprintf("DhtProxy::dhtgetRequestReceived: (%s,%s,%d,stop=%d) from %s\n",
+                  username.c_str(), resource.c_str(), multi, req.stopReq,
+                  pfrom->addr.ToString().c_str());
+
+        sha1_hash ih = dhtTargetHash(username, resource, multi ? "m" : "s");
+        if( !req.stopReq ) {
+            bool fRefused;
+            if( dhtgetPeerReqAdd(ih, pfrom, vReplies, fRefused) ) {
+                dhtGetData(username, resource, multi, false);
+            } else if( fRefused ) {
+                // empty reply: the client's listener gives up on this target
+                CDHTGetReply reply;
+                reply.vchTargetHash = std::vector<char>(ih.begin(), ih.end());
+                vReplies.push_back(reply);
+            }
+        } else {
+            dhtgetPeerReqRemove(ih, pfrom);
+        }
+    }
+
     bool dhtgetRequestReceived(const CDHTGetRequest& req, CNode* pfrom)
     {
         if( fEnabled ) {
@@ -217,25 +382,45 @@ namespace DhtProxy
         } else if( !req.stopReq && checkForAbuse(pfrom, 1) ) {
             return false;
         } else {
-            std::string username(req.vchUsername.data(), req.vchUsername.size());
-            std::string resource(req.vchResource.data(), req.vchResource.size());
-            bool           multi(req.resTypeMulti);
-            
-            dbgprintf("DhtProxy::dhtgetRequestReceived: (%s,%s,%d,stop=%d) from %s\n", 
-                      username.c_str(), resource.c_str(), multi, req.stopReq,
-                      pfrom->addr.ToString().c_str());
-            
-            sha1_hash ih = dhtTargetHash(username, resource, multi ? "m" : "s");
-            if( !req.stopReq ) {
-                dhtgetPeerReqAdd(ih, pfrom);
-                dhtGetData(username, resource, multi, false);
-            } else {
-                dhtgetPeerReqRemove(ih, pfrom);
+            std::vector<CDHTGetReply> vReplies;
+            processGetRequest(req, pfrom, vReplies);
+            BOOST_FOREACH(const CDHTGetReply &reply, vReplies) {
+                pfrom->PushMessage("dhtgetreply", reply);
             }
             return true;
         }
     }
-    
+
+    bool dhtgetRequestReceived(const std::vector<CDHTGetRequest>& vReq, CNode* pfrom)
+    {
+        if( vReq.size() > MAX_DHTGET_BATCH_SIZE ) {
+            return false;
+        }
+
+        int cost = 0;
+        BOOST_FOREACH(const CDHTGetRequest &req, vReq) {
+            if( !req.stopReq )
+                cost++;
+        }
+
+        if( fEnabled ) {
+            // we are using proxy ourselves, we can't be proxy to anyone else
+            pfrom->PushMessage("nodhtproxy");
+            return true;
+        } else if( cost && checkForAbuse(pfrom, cost) ) {
+            return false;
+        } else {
+            std::vector<CDHTGetReply> vReplies;
+            BOOST_FOREACH(const CDHTGetRequest &req, vReq) {
+                processGetRequest(req, pfrom, vReplies);
+            }
+            if( vReplies.size() ) {
+                pfrom->PushMessage("dhtgetreplies", vReplies);
+            }
+            return true;
+        }
+    }
+
     bool dhtgetReplyReceived(const CDHTGetReply& reply, CNode* pfrom)
     {
         std::string strTargetHash(reply.vchTargetHash.data(), reply.vchTargetHash.size());
@@ -307,6 +492,15 @@ namespace DhtProxy
         return true;
     }
 
+    bool dhtgetReplyReceived(const std::vector<CDHTGetReply>& vReply, CNode* pfrom)
+    {
+        bool fAccepted = true;
+        BOOST_FOREACH(const CDHTGetReply &reply, vReply) {
+            fAccepted &= dhtgetReplyReceived(reply, pfrom);
+        }
+        return fAccepted;
+    }
+
 
     void dhtputRequest(std::string const &username, std::string const &resource, bool multi,
                        std::string const &str_p, std::string const &sig_p, std::string const &sig_user)
@@ -43,6 +43,15 @@ class CDHTPutRequest;
  * 9)                                     dhtgetRequestReceived(stopReq=True)
  * 10)                                     (dhtgetPeerReqRemove)
  *
+ * Servers keep the replies of recent lookups for a while, so requests for a
+ * target already being looked up (or looked up recently) are answered from
+ * that cache instead of starting another ses->dht_getData.
+ *
+ * Nodes with version >= DHT_PROXY_BATCH_VERSION also accept "dhtgetreqs"
+ * (a vector of CDHTGetRequest). Cached replies are sent back together in a
+ * single "dhtgetreplies" (vector of CDHTGetReply); replies still in flight
+ * are relayed as usual with "dhtgetreply".
+ *
  **
  *   DHTPut Sequence:
  *
@@ -68,9 +77,19 @@ namespace DhtProxy
     // Stop a dhtget request to the nodes listed. (client side)
     void dhtgetStopRequest(vector<CNode*> vNodesReq, std::string const &username, std::string const &resource, bool multi);
 
+    // Request a batch of dhtgets. (client side)
+    vector<CNode*> dhtgetStartRequest(std::vector<CDHTTarget> const &vTargets);
+
+    // Stop a batch of dhtgets. (client side)
+    void dhtgetStopRequest(vector<CNode*> vNodesReq, std::vector<CDHTTarget> const &vTargets);
+
     // Handle a dhtget request received from TCP. send request to UDP. (server side)
     // return true if accepted.
     bool dhtgetRequestReceived(const CDHTGetRequest& req, CNode* pfrom);
+
+    // Handle a batch of dhtget requests received from TCP. (server side)
+    // return true if accepted.
+    bool dhtgetRequestReceived(const std::vector<CDHTGetRequest>& vReq, CNode* pfrom);
     
     // Handle a dhtget reply received from UDP, send it to the peers that made the request. (server side)
     void dhtgetPeerReqReply(libtorrent::sha1_hash &ih, const libtorrent::alert *a);
@@ -78,6 +97,10 @@ namespace DhtProxy
     // Handle a dhtget reply received from TCP. Will call dhtgetMapPost as needed. (client side)
     // return true if accepted.
     bool dhtgetReplyReceived(const CDHTGetReply& reply, CNode* pfrom);
+
+    // Handle a batch of dhtget replies received from TCP. (client side)
+    // return true if accepted.
+    bool dhtgetReplyReceived(const std::vector<CDHTGetReply>& vReply, CNode* pfrom);
     
     // Request a dhtput.
     void dhtputRequest(std::string const &username, std::string const &resource, bool multi,
@@ -90,6 +113,9 @@ namespace DhtProxy
     vector<CNode*> getRandomDhtProxies(int *totalProxyNodes = NULL);
 }
 
+// max number of requests in a "dhtgetreqs" batch
+static const unsigned int MAX_DHTGET_BATCH_SIZE = 64;
+
 class CDHTTarget
 {
 public:
@@ -102,6 +128,13 @@ public:
         SetNull();
     }
 
+    CDHTTarget(std::string const &username, std::string const &resource, bool multi) :
+        vchUsername(username.begin(), username.end()),
+        vchResource(resource.begin(), resource.end()),
+        resTypeMulti(multi)
+    {
+    }
+
     IMPLEMENT_SERIALIZE
     (
         READWRITE(vchUsername);
@@ -16,6 +16,7 @@
 #include "checkpoints.h"
 #include "softcheckpoint.h"
 #include "twister.h"
+#include "membudget.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -110,6 +111,17 @@ bool ShutdownRequested()
 
 static CCoinsViewDB *pcoinsdbview;
 
+static size_t CoinsCacheUsage()
+{
+    LOCK(cs_main);
+    return pcoinsTip ? pcoinsTip->GetCacheSize() * MEM_COIN_SIZE : 0;
+}
+
+static void CoinsCacheResize(size_t nLimit)
+{
+    nCoinCacheSize = nLimit / MEM_COIN_SIZE;
+}
+
 void Shutdown()
 {
     static CCriticalSection cs_Shutdown;
@@ -132,6 +144,7 @@ void Shutdown()
             pblocktree->Flush();
         if (pcoinsTip)
             pcoinsTip->Flush();
+        FlushPubKeyCache();
         delete pcoinsTip; pcoinsTip = NULL;
         delete pcoinsdbview; pcoinsdbview = NULL;
         delete pblocktree; pblocktree = NULL;
@@ -189,7 +202,11 @@ std::string HelpMessage()
     strUsage += "  -gen                   " + _("Generate coins (default: 0)") + "\n";
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -htmldir=<dir>         " + _("Specify HTML directory to serve (default: <data>/html)") + "\n";
-    strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n";
+    strUsage += "  -maxmemory=<n>         " + _("Memory budget in megabytes shared by all caches below (default: 64)") + "\n";
+    strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: from -maxmemory)") + "\n";
+    strUsage += "  -postcachesize=<n>     " + _("Number of decoded posts kept in memory (default: from -maxmemory)") + "\n";
+    strUsage += "  -torrentcachesize=<n>  " + _("Set torrent read cache size in megabytes (default: from -maxmemory)") + "\n";
+    strUsage += "  -swarmdbcompression    " + _("Compress posts stored in the swarm database, if built with snappy (default: 1)") + "\n";
     strUsage += "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n";
     strUsage += "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n";
     strUsage += "  -socks=<n>             " + _("Select the version of socks proxy to use (4-5, default: 5)") + "\n";
@@ -221,9 +238,11 @@ std::string HelpMessage()
 #endif
     strUsage += "  -testnet               " + _("Use the test network") + "\n";
     strUsage += "  -debug                 " + _("Output extra debugging information. Implies all other -debug* options") + "\n";
+    strUsage += "  -debug=<category>      " + _("Output debugging information of a category only (twister), can be repeated") + "\n";
     strUsage += "  -debugnet              " + _("Output extra network debugging information") + "\n";
     strUsage += "  -logtimestamps         " + _("Prepend debug output with timestamp") + "\n";
     strUsage += "  -shrinkdebugfile       " + _("Shrink debug.log file on client startup (default: 1 when no -debug)") + "\n";
+    strUsage += "  -logratelimit=<n>      " + _("Log the same line at most <n> times per minute, 0 = no limit (default: 600, no limit with -debug)") + "\n";
     strUsage += "  -printtoconsole        " + _("Send trace/debug info to console instead of debug.log file") + "\n";
     strUsage += "  -regtest               " + _("Enter regression test mode, which uses a special chain in which blocks can be "
                                                 "solved instantly. This is intended for regression testing tools and app development.") + "\n";
@@ -249,12 +268,13 @@ std::string HelpMessage()
     strUsage += "  -txindex               " + _("Maintain a full transaction index (default: 0)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + "\n";
     strUsage += "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + "\n";
-    strUsage += "  -par=<n>               " + _("Set the number of script verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n";
+    strUsage += "  -par=<n>               " + _("Set the number of proof-of-work and username verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n";
 
     strUsage += "\n"; _("Block creation options:") + "\n";
     strUsage += "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n";
     strUsage += "  -blockmaxsize=<n>      "   + _("Set maximum block size in bytes (default: 250000)") + "\n";
     strUsage += "  -blockprioritysize=<n> "   + _("Set maximum size of high-priority/low-fee transactions in bytes (default: 27000)") + "\n";
+    strUsage += "  -checkblocktemplate    "   + _("Fully validate each new block template (default: 0)") + "\n";
 
     strUsage += "\n"; _("SSL options: (see the Bitcoin Wiki for SSL setup instructions)") + "\n";
     strUsage += "  -rpcssl                                  " + _("Use OpenSSL (https) for JSON-RPC connections") + "\n";
@@ -487,6 +507,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     fPrintToConsole = GetBoolArg("-printtoconsole", false);
     fPrintToDebugger = GetBoolArg("-printtodebugger", false);
     fLogTimestamps = GetBoolArg("-logtimestamps", false);
+    nLogRateLimit = GetArg("-logratelimit", 600);
 
     if (mapArgs.count("-timeout"))
     {
@@ -515,6 +536,7 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     if (GetBoolArg("-shrinkdebugfile", !fDebug))
         ShrinkDebugFile();
+    threadGroup.create_thread(&ThreadLogWriter);
     printf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     printf("Twister version %s (%s)\n", FormatFullVersion().c_str(), CLIENT_DATE.c_str());
     printf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
@@ -528,6 +550,14 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (fDaemon)
         fprintf(stdout, "Twister server starting\n");
 
+    if (nScriptCheckThreads) {
+        printf("Using %u threads for proof-of-work and username verification\n", nScriptCheckThreads);
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
+            threadGroup.create_thread(&ThreadPoWCheck);
+            threadGroup.create_thread(&ThreadUsernameCheck);
+        }
+    }
+
     int64 nStart;
 
     // ********************************************************* Step 5: verify wallet database integrity
@@ -713,16 +743,35 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
 
     // cache size calculations
-    size_t nTotalCache = GetArg("-dbcache", 25) << 20;
-    if (nTotalCache < (1 << 22))
-        nTotalCache = (1 << 22); // total cache cannot be less than 4 MiB
-    size_t nBlockTreeDBCache = nTotalCache / 8;
-    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false))
-        nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
-    nTotalCache -= nBlockTreeDBCache;
-    size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
-    nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    size_t nMaxMemory = GetArg("-maxmemory", 64) << 20;
+    if (nMaxMemory < (1 << 24))
+        nMaxMemory = (1 << 24); // memory budget cannot be less than 16 MiB
+    memoryBudget.SetTotal(nMaxMemory);
+
+    size_t nBlockTreeDBCache, nCoinDBCache;
+    if (mapArgs.count("-dbcache")) {
+        size_t nTotalCache = GetArg("-dbcache", 25) << 20;
+        if (nTotalCache < (1 << 22))
+            nTotalCache = (1 << 22); // total cache cannot be less than 4 MiB
+        nBlockTreeDBCache = nTotalCache / 8;
+        if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false))
+            nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
+        nTotalCache -= nBlockTreeDBCache;
+        nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
+        nTotalCache -= nCoinDBCache;
+        nCoinCacheSize = nTotalCache / MEM_COIN_SIZE;
+        memoryBudget.SetLimit(MEM_COINS_CACHE, nTotalCache);
+        memoryBudget.Register(MEM_COINS_CACHE, &CoinsCacheUsage);
+    } else {
+        nBlockTreeDBCache = memoryBudget.GetLimit(MEM_BLOCKTREE_DB);
+        if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false))
+            nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
+        nCoinDBCache = memoryBudget.GetLimit(MEM_COINS_DB);
+        nCoinCacheSize = memoryBudget.GetLimit(MEM_COINS_CACHE) / MEM_COIN_SIZE;
+        memoryBudget.Register(MEM_COINS_CACHE, &CoinsCacheUsage, &CoinsCacheResize);
+    }
+    memoryBudget.SetLimit(MEM_BLOCKTREE_DB, nBlockTreeDBCache);
+    memoryBudget.SetLimit(MEM_COINS_DB, nCoinDBCache);
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -809,6 +858,8 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     printf(" block index %15"PRI64d"ms\n", GetTimeMillis() - nStart);
 
+    LoadPubKeyCache();
+
     if (GetBoolArg("-printblockindex", false) || GetBoolArg("-printblocktree", false))
     {
         PrintBlockTree();
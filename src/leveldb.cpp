@@ -24,17 +24,21 @@ void HandleError(const leveldb::Status &status) throw(leveldb_error) {
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize) {
+static leveldb::Options GetOptions(size_t nCacheSize, bool fCompress) {
     leveldb::Options options;
     options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
     options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
+    // snappy works per table block, so it is effective on many small records
+    // repeating the same keys. leveldb falls back to storing blocks raw when
+    // built without snappy, and reads both kinds, so existing databases keep
+    // working and get compressed as they are compacted.
+    options.compression = fCompress ? leveldb::kSnappyCompression : leveldb::kNoCompression;
     options.max_open_files = 64;
     return options;
 }
 
-CLevelDB::CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool fMemory, bool fWipe) {
+CLevelDB::CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool fMemory, bool fWipe, bool fCompress) {
     m_path = path.string();
     m_nCacheSize = nCacheSize;
     penv = NULL;
@@ -42,7 +46,7 @@ CLevelDB::CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, fCompress);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -53,7 +57,7 @@ CLevelDB::CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool
             leveldb::DestroyDB(path.string(), options);
         }
         boost::filesystem::create_directory(path);
-        printf("Opening LevelDB in %s\n", path.string().c_str());
+        printf("Opening LevelDB in %s%s\n", path.string().c_str(), fCompress ? " (compressed)" : "");
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     if (!status.ok())
@@ -82,6 +86,17 @@ bool CLevelDB::WriteBatch(CLevelDBBatch &batch, bool fSync) throw(leveldb_error)
     return true;
 }
 
+bool CLevelDB::ReadRaw(const leveldb::Slice &key, std::string &value) throw(leveldb_error) {
+    leveldb::Status status = pdb->Get(readoptions, key, &value);
+    if (!status.ok()) {
+        if (status.IsNotFound())
+            return false;
+        printf("LevelDB read failure: %s\n", status.ToString().c_str());
+        HandleError(status);
+    }
+    return true;
+}
+
 void CLevelDB::RepairDB()
 {
     printf("CLevelDB::RepairDB trying to repair...\n");
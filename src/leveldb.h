@@ -29,12 +29,12 @@ private:
 
 public:
     template<typename K, typename V> void Write(const K& key, const V& value) {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CPlainDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(ssKey.GetSerializeSize(key));
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        CPlainDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(ssValue.GetSerializeSize(value));
         ssValue << value;
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
@@ -43,13 +43,22 @@ public:
     }
 
     template<typename K> void Erase(const K& key) {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CPlainDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(ssKey.GetSerializeSize(key));
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
     }
+
+    // keys and values already encoded by the caller, written as they are
+    void WriteRaw(const leveldb::Slice &key, const leveldb::Slice &value) {
+        batch.Put(key, value);
+    }
+
+    void EraseRaw(const leveldb::Slice &key) {
+        batch.Delete(key);
+    }
 };
 
 class CLevelDB
@@ -80,11 +89,11 @@ private:
     size_t m_nCacheSize;
 
 public:
-    CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool fCompress = false);
     ~CLevelDB();
 
     template<typename K, typename V> bool Read(const K& key, V& value) throw(leveldb_error) {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CPlainDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(ssKey.GetSerializeSize(key));
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
@@ -98,7 +107,7 @@ public:
             HandleError(status);
         }
         try {
-            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+            CSpanStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
         } catch(std::exception &e) {
             return false;
@@ -113,7 +122,7 @@ public:
     }
 
     template<typename K> bool Exists(const K& key) throw(leveldb_error) {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CPlainDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(ssKey.GetSerializeSize(key));
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
@@ -137,6 +146,10 @@ public:
 
     bool WriteBatch(CLevelDBBatch &batch, bool fSync = false) throw(leveldb_error);
 
+    // read a value written with CLevelDBBatch::WriteRaw, without going
+    // through a CDataStream
+    bool ReadRaw(const leveldb::Slice &key, std::string &value) throw(leveldb_error);
+
     // not available for LevelDB; provide for compatibility with BDB
     bool Flush() {
         return true;
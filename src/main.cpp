@@ -12,6 +12,7 @@
 #include "init.h"
 #include "ui_interface.h"
 #include "checkqueue.h"
+#include "blockfilemap.h"
 #include "chainparams.h"
 #include "dhtproxy.h"
 
@@ -52,6 +53,7 @@ bool fImporting = false;
 bool fReindex = false;
 bool fBenchmark = false;
 bool fTxIndex = true; // always true in twister
+bool fUsernameRegistry = false;
 unsigned int nCoinCacheSize = 5000;
 bool fHaveGUI = false;
 
@@ -60,6 +62,19 @@ CMedianFilter<int> cPeerBlockCounts(8, 0); // Amount of blocks that other nodes
 map<uint256, CBlock*> mapOrphanBlocks;
 multimap<uint256, CBlock*> mapOrphanBlocksByPrev;
 
+// Headers-first sync: the header chain beyond our block index,
+// vHeaderChain[i] is at height nHeaderChainStart + i
+deque<CHeaderChainEntry> vHeaderChain;
+int nHeaderChainStart = 0;
+// since when the download window waits for the first block of the header chain
+int64 nHeaderChainStallStart = 0;
+// the peer the header chain came from, and when a stalled header chain was
+// dropped (0 if none): its headers are then asked from another peer
+CService addrHeaderChainFrom;
+int64 nHeaderChainDropped = 0;
+// blocks of the header chain requested from some peer, and when
+map<uint256, int64> mapBlocksRequested;
+
 // Constant stuff for coinbase transactions we create:
 CScript COINBASE_FLAGS;
 
@@ -532,7 +547,7 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fLimitFr
     // Store transaction in memory
     {
         LOCK(cs);
-        addUnchecked(txhash, tx); // adds to mapTx
+        addUnchecked(txhash, tx); // adds to mapTx and mapTemplate
     }
 
     ///// are we sure this is ok when loading transactions or restoring block txes
@@ -551,6 +566,11 @@ bool CTxMemPool::addUnchecked(const uint256& txhash, CTransaction &tx)
     // call CTxMemPool::accept to properly check the transaction first.
     {
         mapTx[txhash] = tx;
+        // checked by the caller, so it is a template candidate unless its username already has one
+        if( !mapTemplate.count(tx.GetUsernameHash()) )
+            mapTemplate[tx.GetUsernameHash()] = txhash;
+        else
+            setTemplateDirty.insert(txhash);
         nTransactionsUpdated++;
     }
     return true;
@@ -566,6 +586,11 @@ bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
         if (mapTx.count(hash))
         {
             mapTx.erase(hash);
+            setTemplateDirty.erase(hash);
+            // other transactions of this username are waiting in setTemplateDirty
+            map<uint256, uint256>::iterator mi = mapTemplate.find(tx.GetUsernameHash());
+            if (mi != mapTemplate.end() && mi->second == hash)
+                mapTemplate.erase(mi);
             nTransactionsUpdated++;
         }
     }
@@ -576,9 +601,82 @@ void CTxMemPool::clear()
 {
     LOCK(cs);
     mapTx.clear();
+    mapTemplate.clear();
+    setTemplateDirty.clear();
     ++nTransactionsUpdated;
 }
 
+void CTxMemPool::invalidateTemplate(const uint256& userhash)
+{
+    LOCK(cs);
+    map<uint256, uint256>::iterator mi = mapTemplate.find(userhash);
+    if (mi != mapTemplate.end()) {
+        setTemplateDirty.insert(mi->second);
+        mapTemplate.erase(mi);
+    }
+}
+
+void CTxMemPool::updateTemplate()
+{
+    LOCK(cs);
+    set<uint256>::iterator it = setTemplateDirty.begin();
+    while (it != setTemplateDirty.end()) {
+        map<uint256, CTransaction>::iterator mi = mapTx.find(*it);
+        if (mi == mapTx.end()) {
+            setTemplateDirty.erase(it++);
+            continue;
+        }
+        CTransaction& tx = (*mi).second;
+        uint256 userhash = tx.GetUsernameHash();
+        if (mapTemplate.count(userhash)) {
+            // wait for the current candidate to be mined or removed
+            ++it;
+            continue;
+        }
+
+        CTransaction txOld;
+        uint256 hashBlock = 0;
+        if( GetTransaction(tx.GetUsername(), txOld, hashBlock) &&
+            !verifyDuplicateOrReplacementTx(tx, false, true) ) {
+            // not a valid replacement for the current chain, it can't be mined
+            printf("CTxMemPool::updateTemplate() : dropping %s, username already exists (%s)\n",
+                   (*it).ToString().c_str(), tx.GetUsername().c_str());
+            mapTx.erase(mi);
+            setTemplateDirty.erase(it++);
+            nTransactionsUpdated++;
+            continue;
+        }
+        mapTemplate[userhash] = *it;
+        setTemplateDirty.erase(it++);
+    }
+}
+
+bool CTxMemPool::checkTemplate()
+{
+    LOCK(cs);
+    for (map<uint256, uint256>::const_iterator mi = mapTemplate.begin(); mi != mapTemplate.end(); ++mi) {
+        map<uint256, CTransaction>::const_iterator it = mapTx.find(mi->second);
+        if (it == mapTx.end() || it->second.GetUsernameHash() != mi->first || setTemplateDirty.count(mi->second))
+            return error("CTxMemPool::checkTemplate() : bad candidate %s", mi->second.ToString().c_str());
+    }
+    for (map<uint256, CTransaction>::const_iterator it = mapTx.begin(); it != mapTx.end(); ++it) {
+        map<uint256, uint256>::const_iterator mi = mapTemplate.find(it->second.GetUsernameHash());
+        if ((mi == mapTemplate.end() || mi->second != it->first) && !setTemplateDirty.count(it->first))
+            return error("CTxMemPool::checkTemplate() : %s is neither candidate nor dirty", it->first.ToString().c_str());
+    }
+    return true;
+}
+
+void CTxMemPool::resetTemplate()
+{
+    LOCK(cs);
+    mapTemplate.clear();
+    setTemplateDirty.clear();
+    for (map<uint256, CTransaction>::const_iterator it = mapTx.begin(); it != mapTx.end(); ++it)
+        setTemplateDirty.insert(it->first);
+    updateTemplate();
+}
+
 void CTxMemPool::queryHashes(std::vector<uint256>& vtxid)
 {
     vtxid.clear();
@@ -645,10 +743,30 @@ bool CWalletTx::AcceptWalletTransaction()
 
 
 // Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock
-bool GetTransaction(const std::string &username, CTransaction &txOut, uint256 &hashBlock, int maxHeight)
+// (and the height of that block in *pnHeight)
+bool GetTransaction(const std::string &username, CTransaction &txOut, uint256 &hashBlock, int maxHeight, int *pnHeight)
 {
     if( maxHeight < 0 )
         maxHeight = nBestHeight;
+
+    if( fUsernameRegistry ) {
+        // registry is written in the same batch as the tx index by
+        // ConnectBlock/DisconnectBlock, so it only holds main chain records.
+        std::vector<CUsernameRecord> vRecords;
+        if( !pblocktree->ReadUsernameRecords(username, vRecords) )
+            return false;
+        for( int i = vRecords.size() - 1; i >= 0; i-- ) {
+            if( vRecords[i].nHeight <= maxHeight ) {
+                txOut = vRecords[i].tx;
+                hashBlock = vRecords[i].hashBlock;
+                if( pnHeight )
+                    *pnHeight = vRecords[i].nHeight;
+                return true;
+            }
+        }
+        return false;
+    }
+
     {
         LOCK(cs_main);
 
@@ -660,12 +778,21 @@ bool GetTransaction(const std::string &username, CTransaction &txOut, uint256 &h
 
             CDiskTxPos postx;
             if (pblocktree->ReadTxIndex(txid, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
                 CBlockHeader header;
+                const char *pbegin, *pend;
+                boost::shared_ptr<CMappedFile> mapped = GetMappedBlock(postx, pbegin, pend);
                 try {
-                    file >> header;
-                    fseek(file, postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
+                    if (mapped) {
+                        CSpanStream stream(pbegin, pend, SER_DISK, CLIENT_VERSION);
+                        stream >> header;
+                        stream.ignore(postx.nTxOffset);
+                        stream >> txOut;
+                    } else {
+                        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                        file >> header;
+                        fseek(file, postx.nTxOffset, SEEK_CUR);
+                        file >> txOut;
+                    }
                 } catch (std::exception &e) {
                     return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
                 }
@@ -686,6 +813,8 @@ bool GetTransaction(const std::string &username, CTransaction &txOut, uint256 &h
                            username.c_str(), height, header.nHeight, maxHeight);
                     height = header.nHeight-1;
                 } else {
+                    if( pnHeight )
+                        *pnHeight = header.nHeight;
                     return true;
                 }
             } else {
@@ -697,6 +826,29 @@ bool GetTransaction(const std::string &username, CTransaction &txOut, uint256 &h
     return false;
 }
 
+// check if the new key of tx is signed by the key of oldTx
+static bool IsKeyReplacement(const CTransaction &tx, const CTransaction &oldTx)
+{
+    vector< vector<unsigned char> > vData;
+    if( !tx.pubKey.ExtractPushData(vData) || vData.size() < 2 )
+        return false;
+
+    // vData[0] is the (supposedly) new pub key
+    string strNewKey( (char *)vData[0].data(), vData[0].size() );
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << strMessageMagic;
+    ss << strNewKey;
+    uint256 hashNewKey = ss.GetHash();
+
+    // vData[1] is (supposedly) the hash of the new key signed with the old one
+    CPubKey pubkeyRec;
+    vector< vector<unsigned char> > oldvData;
+    return pubkeyRec.RecoverCompact(hashNewKey, vData[1]) &&
+           oldTx.pubKey.ExtractPushData(oldvData) &&
+           oldvData.size() >= 1 &&
+           pubkeyRec.GetID() == CPubKey(oldvData[0]).GetID();
+}
+
 bool verifyDuplicateOrReplacementTx(CTransaction &tx, bool checkDuplicate, bool checkReplacement, int maxHeight, bool removeOrphan)
 {
     CTransaction oldTx;
@@ -706,27 +858,10 @@ bool verifyDuplicateOrReplacementTx(CTransaction &tx, bool checkDuplicate, bool
             return true;
         }
 
-        vector< vector<unsigned char> > vData;
-        if( checkReplacement && tx.pubKey.ExtractPushData(vData) && vData.size() >= 2 ) {
-            // possibly a key replacement. check if new key is signed by the old one.
-
-            // vData[0] is the (supposedly) new pub key
-            string strNewKey( (char *)vData[0].data(), vData[0].size() );
-            CHashWriter ss(SER_GETHASH, 0);
-            ss << strMessageMagic;
-            ss << strNewKey;
-            uint256 hashNewKey = ss.GetHash();
-
-            // vData[1] is (supposedly) the hash of the new key signed with the old one
-            CPubKey pubkeyRec;
-            vector< vector<unsigned char> > oldvData;
-            if (pubkeyRec.RecoverCompact(hashNewKey, vData[1]) &&
-                oldTx.pubKey.ExtractPushData(oldvData) &&
-                oldvData.size() >= 1 &&
-                pubkeyRec.GetID() == CPubKey(oldvData[0]).GetID()) {
-                // good signature. key replacement allowed.
-                return true;
-            }
+        // possibly a key replacement. check if new key is signed by the old one.
+        if( checkReplacement && IsKeyReplacement(tx, oldTx) ) {
+            // good signature. key replacement allowed.
+            return true;
         }
     } else if (removeOrphan) {
         // check if (user,-1) exists in txindex and remove it
@@ -781,25 +916,59 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+boost::shared_ptr<CMappedFile> GetMappedBlock(const CDiskBlockPos& pos, const char*& pbegin, const char*& pend)
 {
-    block.SetNull();
+    // pos is preceded by the index header written by WriteBlockToDisk
+    if (pos.IsNull() || pos.nPos < 8)
+        return boost::shared_ptr<CMappedFile>();
+    boost::shared_ptr<CMappedFile> mapped = blockFileMap.Get(pos.nFile, pos.nPos);
+    if (!mapped)
+        return mapped;
+
+    const char *pheader = mapped->begin() + pos.nPos - 8;
+    if (memcmp(pheader, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+        return boost::shared_ptr<CMappedFile>();
+    unsigned int nSize;
+    memcpy(&nSize, pheader + MESSAGE_START_SIZE, sizeof(nSize));
+    if (nSize > MAX_BLOCK_SIZE)
+        return boost::shared_ptr<CMappedFile>();
+    if (mapped->size() < pos.nPos + nSize) {
+        // written after the file was mapped
+        mapped = blockFileMap.Get(pos.nFile, pos.nPos + nSize);
+        if (!mapped)
+            return mapped;
+    }
 
-    // Open history file to read
-    CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (!filein)
-        return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : OpenBlockFile failed");
+    pbegin = mapped->begin() + pos.nPos;
+    pend = pbegin + nSize;
+    return mapped;
+}
 
-    // Read block
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckPOW)
+{
+    block.SetNull();
+
+    // Read block, from the mapped file if possible
+    const char *pbegin, *pend;
+    boost::shared_ptr<CMappedFile> mapped = GetMappedBlock(pos, pbegin, pend);
     try {
-        filein >> block;
+        if (mapped) {
+            CSpanStream stream(pbegin, pend, SER_DISK, CLIENT_VERSION);
+            stream >> block;
+        } else {
+            // Open history file to read
+            CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (!filein)
+                return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : OpenBlockFile failed");
+            filein >> block;
+        }
     }
     catch (std::exception &e) {
         return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
     }
 
     // Check the header
-    if (!CheckProofOfWork(block.GetPoWHash(), block.nBits))
+    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits))
         return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : errors in block header");
 
     return true;
@@ -807,7 +976,9 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    // proof of work was checked before the block got into the index, matching
+    // the hash is enough to know the header is the same
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), false))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
@@ -1068,12 +1239,21 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock() : block and undo data inconsistent");
 
+    std::map<std::string, std::vector<CUsernameRecord> > mapUserRecords;
+    std::vector<std::string> vRemovedNames;
+
     // undo transactions in reverse order
     // [MF] just remove from txIndex, no more coins
     for (int i = block.vtx.size() - 1; i >= 1; i--) {
         const CTransaction &tx = block.vtx[i];
 
         if( !fJustCheck ) {
+          if( !mapUserRecords.count(tx.GetUsername()) )
+              pblocktree->ReadUsernameRecords(tx.GetUsername(), mapUserRecords[tx.GetUsername()]);
+          std::vector<CUsernameRecord> &vRecords = mapUserRecords[tx.GetUsername()];
+          while( vRecords.size() && vRecords.back().nHeight >= block.nHeight )
+              vRecords.pop_back();
+
           uint256 oldTxid = SerializeHash(make_pair(tx.GetUsername(),block.nHeight-1));
           CDiskTxPos oldPos;
           if( pblocktree->ReadTxIndex(oldTxid, oldPos) ) {
@@ -1085,10 +1265,18 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
               vPos.push_back(std::make_pair(txid, oldPos));
               if (!pblocktree->WriteTxIndex(vPos))
                   return state.Abort(_("Failed to write transaction index"));
+          } else {
+              // username registered by this block
+              usernameIndex.Remove(tx.GetUsername());
+              vRemovedNames.push_back(tx.GetUsername());
           }
+          pubKeyCache.Erase(tx.GetUsername());
         }
     }
 
+    if (!fJustCheck && !pblocktree->WriteUsernameRecords(mapUserRecords, vRemovedNames))
+        return state.Abort(_("Failed to write username registry"));
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev);
 
@@ -1103,8 +1291,11 @@ void static FlushBlockFile(bool fFinalize = false)
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
-        if (fFinalize)
+        if (fFinalize) {
+            // readers still holding the old mapping only access blocks below nSize
+            blockFileMap.Invalidate(nLastBlockFile);
             TruncateFile(fileOld, infoLastBlockFile.nSize);
+        }
         FileCommit(fileOld);
         fclose(fileOld);
     }
@@ -1120,10 +1311,81 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
+// registry and tx index entries of a block transaction's username, read
+// before the block is connected
+struct CUsernamePrefetch
+{
+    std::vector<CUsernameRecord> vRecords;
+    CDiskTxPos oldPos;
+    bool fHaveOldPos;
+    // the (username,-1) tx index entry has no registry record, see verifyDuplicateOrReplacementTx
+    bool fEraseOrphan;
+
+    CUsernamePrefetch() : fHaveOldPos(false), fEraseOrphan(false) {}
+};
+
+// newest record not above maxHeight
+static const CUsernameRecord *FindUsernameRecord(const std::vector<CUsernameRecord> &vRecords, int maxHeight)
+{
+    for (int i = vRecords.size() - 1; i >= 0; i--)
+        if (vRecords[i].nHeight <= maxHeight)
+            return &vRecords[i];
+    return NULL;
+}
+
+// reads the entries of a username and does the overwrite check of ConnectBlock
+// with them (the GetTransaction/verifyDuplicateOrReplacementTx pair, registry
+// version), run by the -par worker threads.
+class CUsernameCheck
+{
+private:
+    const CTransaction *ptx;
+    int nHeight;     // of the block being connected
+    int nMaxHeight;  // best height when the check was queued
+    CUsernamePrefetch *pprefetch;
+
+public:
+    CUsernameCheck() : ptx(NULL), nHeight(0), nMaxHeight(0), pprefetch(NULL) {}
+    CUsernameCheck(const CTransaction *ptxIn, int nHeightIn, int nMaxHeightIn, CUsernamePrefetch *pprefetchIn) :
+        ptx(ptxIn), nHeight(nHeightIn), nMaxHeight(nMaxHeightIn), pprefetch(pprefetchIn) {}
+
+    bool operator()() {
+        std::string username = ptx->GetUsername();
+        pblocktree->ReadUsernameRecords(username, pprefetch->vRecords);
+        uint256 txid = SerializeHash(make_pair(username,-1));
+        pprefetch->fHaveOldPos = pblocktree->ReadTxIndex(txid, pprefetch->oldPos);
+
+        if (!FindUsernameRecord(pprefetch->vRecords, nMaxHeight))
+            return true;
+        // only the same transaction or a key replacement may overwrite it
+        const CUsernameRecord *pOld = FindUsernameRecord(pprefetch->vRecords, nHeight);
+        if (!pOld) {
+            pprefetch->fEraseOrphan = pprefetch->fHaveOldPos;
+            return pprefetch->fEraseOrphan;
+        }
+        return pOld->tx.GetHash() == ptx->GetHash() || IsKeyReplacement(*ptx, pOld->tx);
+    }
+
+    void swap(CUsernameCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(nHeight, check.nHeight);
+        std::swap(nMaxHeight, check.nMaxHeight);
+        std::swap(pprefetch, check.pprefetch);
+    }
+};
+
+static CCheckQueue<CUsernameCheck> usernamecheckqueue(32);
+
+void ThreadUsernameCheck() {
+    RenameThread("bitcoin-userch");
+    usernamecheckqueue.Thread();
+}
+
 bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
 {
-    // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
+    // Check it again in case a previous version let a bad block in.
+    // Proof of work is not redone: pindex is only created for blocks which passed it.
+    if (!CheckBlock(block, state, false, !fJustCheck))
         return false;
 
     // verify that the view's current state corresponds to the previous block
@@ -1177,22 +1439,54 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // except if they are signed by the older one (key replacement)
-    for (unsigned int i = 1; i < block.vtx.size(); i++) {
-        CTransaction &tx = block.vtx[i];
+    /* We have index for this username, which is not allowed, except:
+     * 1) same transaction. this shouldn't happen but it does if twisterd terminates badly.
+     *    explanation: TxIndex seems to get out-of-sync with block chain, so it may try to
+     *    reconnect blocks which transactions are already written to the tx index.
+     * 2) possibly a key replacement. check if new key is signed by the old one.
+     */
+    std::vector<CUsernamePrefetch> vPrefetch(block.vtx.size());
+    if( fUsernameRegistry ) {
+        // the usernames are unique within the block (CheckBlock), so each
+        // check only touches its own prefetch entry
+        std::vector<CUsernameCheck> vChecks;
+        vChecks.reserve(block.vtx.size()-1);
+        for (unsigned int i = 1; i < block.vtx.size(); i++)
+            vChecks.push_back(CUsernameCheck(&block.vtx[i], block.nHeight, nBestHeight, &vPrefetch[i]));
+
+        CCheckQueueControl<CUsernameCheck> control(nScriptCheckThreads ? &usernamecheckqueue : NULL);
+        bool fValid = true;
+        if (nScriptCheckThreads)
+            control.Add(vChecks);
+        else
+            for (unsigned int i = 0; fValid && i < vChecks.size(); i++)
+                fValid = vChecks[i]();
+        if (!control.Wait() || !fValid) {
+            // not the same, not replacement => error!
+            return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"));
+        }
 
-        CTransaction txOld;
-        uint256 hashBlock = 0;
-        if( GetTransaction(block.vtx[i].GetUsername(), txOld, hashBlock) ) {
-            /* We have index for this username, which is not allowed, except:
-             * 1) same transaction. this shouldn't happen but it does if twisterd terminates badly.
-             *    explanation: TxIndex seems to get out-of-sync with block chain, so it may try to
-             *    reconnect blocks which transactions are already written to the tx index.
-             * 2) possibly a key replacement. check if new key is signed by the old one.
-             */
-            if( !verifyDuplicateOrReplacementTx(tx, true, true, block.nHeight, true) ) {
+        for (unsigned int i = 1; i < block.vtx.size(); i++) {
+            if (vPrefetch[i].fEraseOrphan) {
+                pblocktree->EraseTxIndex(SerializeHash(make_pair(block.vtx[i].GetUsername(),-1)));
+                vPrefetch[i].fHaveOldPos = false;
+            }
+        }
+    } else {
+        for (unsigned int i = 1; i < block.vtx.size(); i++) {
+            CTransaction &tx = block.vtx[i];
+
+            CTransaction txOld;
+            uint256 hashBlock = 0;
+            if( GetTransaction(tx.GetUsername(), txOld, hashBlock) &&
+                !verifyDuplicateOrReplacementTx(tx, true, true, block.nHeight, true) ) {
                 // not the same, not replacement => error!
                 return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"));
             }
+
+            pblocktree->ReadUsernameRecords(tx.GetUsername(), vPrefetch[i].vRecords);
+            uint256 txid = SerializeHash(make_pair(tx.GetUsername(),-1));
+            vPrefetch[i].fHaveOldPos = pblocktree->ReadTxIndex(txid, vPrefetch[i].oldPos);
         }
     }
 
@@ -1204,6 +1498,7 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
     vPos.reserve(block.vtx.size()-1);
     std::vector<std::string> vUsernames;
     vUsernames.reserve(block.vtx.size()-1);
+    std::map<std::string, std::vector<CUsernameRecord> > mapUserRecords;
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = block.vtx[i];
@@ -1215,8 +1510,17 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
             vPos.push_back(std::make_pair(txid, pos));
             vUsernames.push_back(tx.GetUsername());
 
-            CDiskTxPos oldPos;
-            if( pblocktree->ReadTxIndex(txid, oldPos) && pos != oldPos ) {
+            if (!fJustCheck) {
+                std::vector<CUsernameRecord> &vRecords = mapUserRecords[tx.GetUsername()];
+                vRecords.swap(vPrefetch[i].vRecords);
+                // drop leftovers of a chain that is no longer ours
+                while (vRecords.size() && vRecords.back().nHeight >= block.nHeight)
+                    vRecords.pop_back();
+                vRecords.push_back(CUsernameRecord(block.nHeight, pindex->GetBlockHash(), tx));
+            }
+
+            const CDiskTxPos &oldPos = vPrefetch[i].oldPos;
+            if( vPrefetch[i].fHaveOldPos && pos != oldPos ) {
                 printf("ConnectBlock: save old txid user: %s height: %d\n",
                        tx.GetUsername().c_str(), block.nHeight);
                 uint256 oldTxid = SerializeHash(make_pair(tx.GetUsername(),block.nHeight-1));
@@ -1254,13 +1558,14 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
             return state.Abort(_("Failed to write block index"));
     }
 
+    // tx index, username registry and partial name tree in a single batch
     assert(fTxIndex);
-    if (!pblocktree->WriteTxIndex(vPos))
+    if (!pblocktree->WriteTxIndex(vPos, mapUserRecords, vUsernames))
         return state.Abort(_("Failed to write transaction index"));
 
     for (size_t i=0; i<vUsernames.size(); i++) {
-        if (!pblocktree->AddNameToPartialNameTree(vUsernames.at(i)))
-            return state.Abort(_("Failed to write partial name index"));
+        usernameIndex.Add(vUsernames.at(i));
+        pubKeyCache.Erase(vUsernames.at(i));
     }
 
     // add this block to the view's block chain
@@ -1326,6 +1631,7 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
 
     // Disconnect shorter branch
     vector<CTransaction> vResurrect;
+    set<uint256> setUsersChanged;
     BOOST_FOREACH(CBlockIndex* pindex, vDisconnect) {
         CBlock block;
         if (!ReadBlockFromDisk(block, pindex))
@@ -1339,9 +1645,13 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
         // Queue memory transactions to resurrect.
         // We only do this for blocks after the last checkpoint (reorganisation before that
         // point should only happen with -reindex/-loadblock, or a misbehaving peer.
-        BOOST_FOREACH(const CTransaction& tx, block.vtx)
-            if (!tx.IsSpamMessage() && pindex->nHeight > Checkpoints::GetTotalBlocksEstimate())
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            if (tx.IsSpamMessage())
+                continue;
+            setUsersChanged.insert(tx.GetUsernameHash());
+            if (pindex->nHeight > Checkpoints::GetTotalBlocksEstimate())
                 vResurrect.push_back(tx);
+        }
     }
 
     // Connect longer branch
@@ -1362,8 +1672,11 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
             printf("- Connect: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
 
         // Queue memory transactions to delete
-        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
             vDelete.push_back(tx);
+            if (!tx.IsSpamMessage())
+                setUsersChanged.insert(tx.GetUsernameHash());
+        }
     }
 
     // Flush changes to global coin state
@@ -1399,6 +1712,11 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
     BOOST_FOREACH(CBlockIndex* pindex, vConnect)
         vBlockIndexByHeight[pindex->nHeight] = pindex;
 
+    // Template candidates of the usernames changed by the reorganization
+    // were checked against the old chain
+    BOOST_FOREACH(const uint256& userhash, setUsersChanged)
+        mempool.invalidateTemplate(userhash);
+
     // Resurrect memory transactions that were in the disconnected branch
     BOOST_FOREACH(CTransaction& tx, vResurrect) {
         // ignore validation errors in resurrected transactions
@@ -1764,6 +2082,255 @@ void PushGetBlocks(CNode* pnode, CBlockIndex* pindexBegin, uint256 hashEnd)
     pnode->PushMessage("getblocks", CBlockLocator(pindexBegin), hashEnd);
 }
 
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Headers-first sync
+//
+// The sync peer sends us the headers of its chain first ("getheaders"), which
+// only costs a PoW check each. The blocks of that header chain are then
+// requested from all peers at once, in a window moving along with our best
+// block, so they arrive nearly in order and the orphan pool holds no more
+// than the window. Blocks not delivered in time are asked from another peer.
+// A header chain whose first block nobody delivers is dropped.
+//
+
+static bool IsInHeaderChain(const CBlockHeader& header, const uint256& hash)
+{
+    int i = header.nHeight - nHeaderChainStart;
+    return i >= 0 && i < (int)vHeaderChain.size() && vHeaderChain[i].hash == hash;
+}
+
+// drop the front of the header chain which made it into the block index
+static void TrimHeaderChain()
+{
+    while (!vHeaderChain.empty())
+    {
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(vHeaderChain.front().hash);
+        if (mi == mapBlockIndex.end())
+            break;
+        mapBlocksRequested.erase(vHeaderChain.front().hash);
+        vHeaderChain.pop_front();
+        nHeaderChainStart++;
+        nHeaderChainStallStart = 0;
+        // the next header now follows a block of the block index
+        if (!vHeaderChain.empty())
+            vHeaderChain.front().index.pprev = (*mi).second;
+    }
+}
+
+void ClearHeaderChain()
+{
+    BOOST_FOREACH(const CHeaderChainEntry& entry, vHeaderChain)
+        mapBlocksRequested.erase(entry.hash);
+    vHeaderChain.clear();
+    nHeaderChainStallStart = 0;
+}
+
+// an invalid block invalidates the header chain from there on
+static void TruncateHeaderChain(const CBlockHeader& header, const uint256& hash)
+{
+    if (!IsInHeaderChain(header, hash))
+        return;
+    printf("TruncateHeaderChain() : dropping headers from height %d\n", header.nHeight);
+    while ((int)vHeaderChain.size() > header.nHeight - nHeaderChainStart)
+    {
+        mapBlocksRequested.erase(vHeaderChain.back().hash);
+        vHeaderChain.pop_back();
+    }
+}
+
+void PushGetHeaders(CNode* pnode)
+{
+    CBlockLocator locator(pindexBest);
+    if (!vHeaderChain.empty())
+        locator.Prepend(vHeaderChain.back().hash);
+    pnode->PushMessage("getheaders", locator, uint256(0));
+}
+
+// scrypt hash of a header, computed by the pow check workers
+class CPoWCheck
+{
+private:
+    CBlockHeader header;
+    uint256 *phashPoW;
+
+public:
+    CPoWCheck() : phashPoW(NULL) {}
+    CPoWCheck(const CBlockHeader& headerIn, uint256 *phashPoWIn) : header(headerIn), phashPoW(phashPoWIn) {}
+
+    bool operator()() {
+        *phashPoW = CBlock(header).GetPoWHash();
+        return true;
+    }
+
+    void swap(CPoWCheck &check) {
+        std::swap(header, check.header);
+        std::swap(phashPoW, check.phashPoW);
+    }
+};
+
+static CCheckQueue<CPoWCheck> powcheckqueue(32);
+
+void ThreadPoWCheck() {
+    RenameThread("bitcoin-powch");
+    powcheckqueue.Thread();
+}
+
+// scrypt hashes of a batch of headers, spread among the -par worker threads.
+// headers we already have or which can't extend the header chain are left as
+// zero, AcceptHeader hashes them itself if it gets that far.
+static void GetPoWHashes(const vector<CBlock>& vHeaders, vector<uint256>& vHashPoW)
+{
+    vHashPoW.assign(vHeaders.size(), 0);
+    vector<CPoWCheck> vChecks;
+    vChecks.reserve(vHeaders.size());
+    uint256 hashLast = vHeaderChain.empty() ? uint256(0) : vHeaderChain.back().hash;
+    for (unsigned int i = 0; i < vHeaders.size(); i++)
+    {
+        uint256 hash = vHeaders[i].GetHash();
+        bool fLinks = vHeaders[i].hashPrevBlock == hashLast ||
+                      (vHeaderChain.empty() && mapBlockIndex.count(vHeaders[i].hashPrevBlock));
+        hashLast = hash;
+        if (!fLinks || mapBlockIndex.count(hash) || IsInHeaderChain(vHeaders[i], hash))
+            continue;
+        vChecks.push_back(CPoWCheck(vHeaders[i], &vHashPoW[i]));
+    }
+
+    CCheckQueueControl<CPoWCheck> control(nScriptCheckThreads ? &powcheckqueue : NULL);
+    if (nScriptCheckThreads)
+        control.Add(vChecks);
+    else
+        BOOST_FOREACH(CPoWCheck& check, vChecks)
+            check();
+    control.Wait();
+}
+
+static bool AcceptHeader(CValidationState &state, const CBlockHeader& header, const uint256& hashPoW)
+{
+    uint256 hash = header.GetHash();
+    if (mapBlockIndex.count(hash) || IsInHeaderChain(header, hash))
+        return true;
+
+    CBlockIndex* pindexPrev;
+    if (!vHeaderChain.empty() && header.hashPrevBlock == vHeaderChain.back().hash)
+        pindexPrev = &vHeaderChain.back().index;
+    else
+    {
+        // a new header chain must start from a block we have. while one is
+        // being downloaded, competing branches are left to the getblocks path.
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(header.hashPrevBlock);
+        if (!vHeaderChain.empty() || mi == mapBlockIndex.end())
+            return true;
+        pindexPrev = (*mi).second;
+    }
+
+    if (header.nHeight != pindexPrev->nHeight + 1)
+        return state.DoS(100, error("AcceptHeader() : incorrect height"));
+    // the headers before are indexed, in the header chain or the block index
+    if (header.nBits != GetNextWorkRequired(pindexPrev, &header))
+        return state.DoS(100, error("AcceptHeader() : incorrect proof of work"));
+
+    if (!CheckProofOfWork(hashPoW != 0 ? hashPoW : CBlock(header).GetPoWHash(), header.nBits))
+        return state.DoS(50, error("AcceptHeader() : proof of work failed"));
+
+    if (header.GetBlockTime() > GetAdjustedTime() + 2 * 60 * 60)
+        return state.Invalid(error("AcceptHeader() : block timestamp too far in the future"));
+
+    // same protection against cheap headers as for orphan blocks
+    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+    if (pcheckpoint)
+    {
+        int64 deltaTime = header.GetBlockTime() - pcheckpoint->nTime;
+        if (deltaTime < 0)
+            return state.DoS(100, error("AcceptHeader() : block with timestamp before last checkpoint"));
+        CBigNum bnNewBlock;
+        bnNewBlock.SetCompact(header.nBits);
+        CBigNum bnRequired;
+        bnRequired.SetCompact(ComputeMinWork(pcheckpoint->nBits, deltaTime));
+        if (bnNewBlock > bnRequired)
+            return state.DoS(100, error("AcceptHeader() : block with too little proof-of-work"));
+    }
+
+    if (vHeaderChain.empty())
+        nHeaderChainStart = header.nHeight;
+    CBlockHeader headerCopy(header);
+    vHeaderChain.push_back(CHeaderChainEntry());
+    // elements of a deque stay in place as it grows, pprev of the next one can point here
+    CHeaderChainEntry& entry = vHeaderChain.back();
+    entry.hash = hash;
+    entry.index = CBlockIndex(headerCopy);
+    entry.index.phashBlock = &entry.hash;
+    entry.index.pprev = pindexPrev;
+    entry.index.nHeight = header.nHeight;
+    entry.index.nChainWork = pindexPrev->nChainWork + entry.index.GetBlockWork().getuint256();
+    return true;
+}
+
+// fill the free download slots of pto with blocks from the window
+void GetBlocksToDownload(CNode* pto, vector<CInv>& vGetData)
+{
+    TrimHeaderChain();
+    int64 nNow = GetTime();
+
+    // after a stalled header chain was dropped, sync goes on with headers
+    // from another peer. the same one is asked again if it's the only one.
+    if (nHeaderChainDropped && vHeaderChain.empty() &&
+        (pto->addr != addrHeaderChainFrom || nNow - nHeaderChainDropped > BLOCK_STALL_DROP))
+    {
+        nHeaderChainDropped = 0;
+        PushGetHeaders(pto);
+        return;
+    }
+
+    // forget about blocks that arrived, from this peer or another one
+    for (map<uint256, int64>::iterator it = pto->mapBlocksInFlight.begin(); it != pto->mapBlocksInFlight.end(); )
+    {
+        if (!mapBlocksRequested.count((*it).first))
+            pto->mapBlocksInFlight.erase(it++);
+        else
+            it++;
+    }
+
+    // only a header chain with more work than our best chain is worth its blocks
+    if (vHeaderChain.empty() || vHeaderChain.back().index.nChainWork <= nBestChainWork)
+        return;
+
+    // the first block of the window is what everything else waits for. if
+    // no peer delivers it, the header chain isn't worth waiting for either.
+    if (nHeaderChainStallStart == 0)
+        nHeaderChainStallStart = nNow;
+    else if (nNow - nHeaderChainStallStart > BLOCK_STALL_DROP)
+    {
+        printf("block %d of the header chain not delivered, dropping header chain\n", nHeaderChainStart);
+        ClearHeaderChain();
+        nHeaderChainDropped = nNow;
+        return;
+    }
+
+    int nWindowEnd = min((int)vHeaderChain.size(), nBestHeight + 1 + BLOCK_DOWNLOAD_WINDOW - nHeaderChainStart);
+    for (int i = 0; i < nWindowEnd && (int)pto->mapBlocksInFlight.size() < MAX_BLOCKS_IN_FLIGHT; i++)
+    {
+        // the peer told us how far its chain went when we connected
+        if (pto->nStartingHeight >= 0 && nHeaderChainStart + i > pto->nStartingHeight)
+            break;
+
+        const uint256& hash = vHeaderChain[i].hash;
+        if (pto->mapBlocksInFlight.count(hash) || mapOrphanBlocks.count(hash))
+            continue;
+        map<uint256, int64>::iterator mi = mapBlocksRequested.find(hash);
+        if (mi != mapBlocksRequested.end() && nNow - (*mi).second < BLOCK_STALL_TIMEOUT)
+            continue;
+
+        mapBlocksRequested[hash] = nNow;
+        pto->mapBlocksInFlight[hash] = nNow;
+        vGetData.push_back(CInv(MSG_BLOCK, hash));
+    }
+}
+
 bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp)
 {
     // Check for duplicate
@@ -1773,8 +2340,9 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
     if (mapOrphanBlocks.count(hash))
         return state.Invalid(error("ProcessBlock() : already have block (orphan) %s", hash.ToString().c_str()));
 
-    // Preliminary checks
-    if (!CheckBlock(*pblock, state))
+    // Preliminary checks. Blocks of the header chain already had their
+    // proof of work checked along with the header.
+    if (!CheckBlock(*pblock, state, !IsInHeaderChain(*pblock, hash)))
         return error("ProcessBlock() : CheckBlock FAILED");
 
     CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
@@ -1808,8 +2376,10 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
             mapOrphanBlocks.insert(make_pair(hash, pblock2));
             mapOrphanBlocksByPrev.insert(make_pair(pblock2->hashPrevBlock, pblock2));
 
-            // Ask this guy to fill in what we're missing
-            PushGetBlocks(pfrom, pindexBest, GetOrphanRoot(pblock2));
+            // Ask this guy to fill in what we're missing, unless the block is
+            // in the header chain: its parents come with the download window
+            if (!IsInHeaderChain(*pblock2, hash))
+                PushGetBlocks(pfrom, pindexBest, GetOrphanRoot(pblock2));
         }
         return true;
     }
@@ -2090,6 +2660,12 @@ bool static LoadBlockIndexDB()
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
 
+    std::vector<std::string> vNames;
+    if (!pblocktree->LoadNames(vNames))
+        return false;
+    usernameIndex.Load(vNames);
+    printf("LoadBlockIndexDB(): %u usernames\n", (unsigned)usernameIndex.Size());
+
     boost::this_thread::interruption_point();
 
     // Calculate nChainWork
@@ -2132,6 +2708,11 @@ bool static LoadBlockIndexDB()
     //printf("LoadBlockIndexDB(): transaction index %s\n", readTxIndex ? "enabled" : "disabled");
     //assert( readTxIndex ); // always true in twister
 
+    // databases created before the username registry need a reindex to use it
+    fUsernameRegistry = false;
+    pblocktree->ReadFlag("usernameregistry", fUsernameRegistry);
+    printf("LoadBlockIndexDB(): username registry %s\n", fUsernameRegistry ? "enabled" : "disabled (use -reindex)");
+
     // Load hashBestChain pointer to end of best chain
     pindexBest = pcoinsTip->GetBestBlock();
     if (pindexBest == NULL)
@@ -2240,6 +2821,8 @@ void UnloadBlockIndex()
     nBestInvalidWork = 0;
     hashBestChain = 0;
     pindexBest = NULL;
+    usernameIndex.Clear();
+    pubKeyCache.Clear();
 }
 
 bool LoadBlockIndex()
@@ -2250,6 +2833,47 @@ bool LoadBlockIndex()
     return true;
 }
 
+void LoadPubKeyCache()
+{
+    LOCK(cs_main);
+    int64 nStart = GetTimeMillis();
+
+    uint256 hashBlock;
+    if (!pubKeyCache.Read(GetDataDir() / "pubkeys.dat", hashBlock))
+        return;
+
+    std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockIndex *pindex = (mi != mapBlockIndex.end()) ? mi->second : NULL;
+    if (!pindex || !pindex->IsInMainChain() || nBestHeight - pindex->nHeight > PUBKEYCACHE_MAX_BEHIND) {
+        printf("LoadPubKeyCache: snapshot does not match the best chain, discarded\n");
+        pubKeyCache.Clear();
+        return;
+    }
+
+    // forget the users touched by blocks connected after the snapshot
+    while ((pindex = pindex->GetNextInMainChain()) != NULL) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex)) {
+            printf("LoadPubKeyCache: ReadBlockFromDisk failed at %d, snapshot discarded\n", pindex->nHeight);
+            pubKeyCache.Clear();
+            return;
+        }
+        for (unsigned int i = 1; i < block.vtx.size(); i++)
+            pubKeyCache.Erase(block.vtx[i].GetUsername());
+    }
+
+    printf("Loaded %"PRIszu" pubkeys from pubkeys.dat  %"PRI64d"ms\n",
+           pubKeyCache.Size(), GetTimeMillis() - nStart);
+}
+
+void FlushPubKeyCache()
+{
+    LOCK(cs_main);
+    if (hashBestChain == 0)
+        return;
+    pubKeyCache.Write(GetDataDir() / "pubkeys.dat", hashBestChain);
+}
+
 
 bool InitBlockIndex() {
     // Check whether we're already initialized
@@ -2259,6 +2883,8 @@ bool InitBlockIndex() {
     // Use the provided setting for -txindex in the new database
     fTxIndex = true;
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fUsernameRegistry = true;
+    pblocktree->WriteFlag("usernameregistry", fUsernameRegistry);
     printf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -2562,9 +3188,18 @@ void static ProcessGetData(CNode* pfrom)
                 map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
-                    CBlock block;
-                    ReadBlockFromDisk(block, (*mi).second);
+                    // send the block as it is in the mapped file, no need to deserialize it
+                    const char *pbegin, *pend;
+                    boost::shared_ptr<CMappedFile> mapped;
                     if (inv.type == MSG_BLOCK)
+                        mapped = GetMappedBlock((*mi).second->GetBlockPos(), pbegin, pend);
+
+                    CBlock block;
+                    if (!mapped)
+                        ReadBlockFromDisk(block, (*mi).second);
+                    if (mapped)
+                        pfrom->PushRawMessage("block", pbegin, pend);
+                    else if (inv.type == MSG_BLOCK)
                         pfrom->PushMessage("block", block);
                     else // MSG_FILTERED_BLOCK)
                     {
@@ -2607,7 +3242,7 @@ void static ProcessGetData(CNode* pfrom)
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CPlainDataStream>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
                         pfrom->PushMessage(inv.GetCommand(), (*mi).second);
                         pushed = true;
@@ -2617,7 +3252,7 @@ void static ProcessGetData(CNode* pfrom)
                     LOCK(mempool.cs);
                     if (mempool.exists(inv.hash)) {
                         CTransaction tx = mempool.lookup(inv.hash);
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                        CPlainDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << tx;
                         pfrom->PushMessage("tx", ss);
@@ -2648,7 +3283,7 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
-bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
+bool static ProcessMessage(CNode* pfrom, string strCommand, CPlainDataStream& vRecv)
 {
     RandAddSeedPerfmon();
     if (fDebug)
@@ -2880,10 +3515,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                 printf("  got inventory: %s  %s\n", inv.ToString().c_str(), fAlreadyHave ? "have" : "new");
 
             if (!fAlreadyHave) {
-                if (!fImporting && !fReindex)
+                // while catching up, learn where a new block fits from its header
+                if (inv.type == MSG_BLOCK && IsInitialBlockDownload() && !fImporting && !fReindex)
+                    PushGetHeaders(pfrom);
+                else if (!fImporting && !fReindex)
                     pfrom->AskFor(inv);
             } else if (inv.type == MSG_BLOCK && mapOrphanBlocks.count(inv.hash)) {
-                PushGetBlocks(pfrom, pindexBest, GetOrphanRoot(mapOrphanBlocks[inv.hash]));
+                if (!IsInHeaderChain(*mapOrphanBlocks[inv.hash], inv.hash))
+                    PushGetBlocks(pfrom, pindexBest, GetOrphanRoot(mapOrphanBlocks[inv.hash]));
             } else if (nInv == nLastBlock) {
                 // In case we are on a very long side-chain, it is possible that we already have
                 // the last block in an inv bundle sent in response to getblocks. Try to detect
@@ -2979,7 +3618,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 
         // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
         vector<CBlock> vHeaders;
-        int nLimit = 2000;
+        int nLimit = MAX_HEADERS_RESULTS;
         printf("getheaders %d to %s\n", (pindex ? pindex->nHeight : -1), hashStop.ToString().c_str());
         for (; pindex; pindex = pindex->GetNextInMainChain())
         {
@@ -2991,9 +3630,56 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     }
 
 
+    else if (strCommand == "headers" && !fImporting && !fReindex)
+    {
+        // sent as CBlocks without transactions, see getheaders
+        vector<CBlock> vHeaders;
+        vRecv >> vHeaders;
+        if (vHeaders.size() > MAX_HEADERS_RESULTS)
+        {
+            pfrom->Misbehaving(20);
+            return error("message headers size() = %"PRIszu"", vHeaders.size());
+        }
+
+        vector<uint256> vHashPoW;
+        GetPoWHashes(vHeaders, vHashPoW);
+        bool fNewChain = vHeaderChain.empty();
+        for (unsigned int i = 0; i < vHeaders.size(); i++)
+        {
+            CValidationState state;
+            if (!AcceptHeader(state, vHeaders[i], vHashPoW[i]))
+            {
+                int nDoS;
+                if (state.IsInvalid(nDoS))
+                    pfrom->Misbehaving(nDoS);
+                return true;
+            }
+            if (fNewChain && !vHeaderChain.empty())
+            {
+                addrHeaderChainFrom = pfrom->addr;
+                fNewChain = false;
+            }
+        }
+        if (fDebug)
+            printf("received %"PRIszu" headers, header chain %d..%d\n", vHeaders.size(),
+                   nHeaderChainStart, nHeaderChainStart + (int)vHeaderChain.size() - 1);
+
+        // a full batch means there is more. otherwise the header chain is
+        // complete and only worth keeping if it has more work than ours.
+        if (vHeaders.size() == MAX_HEADERS_RESULTS)
+            PushGetHeaders(pfrom);
+        else if (!vHeaderChain.empty() && vHeaderChain.back().index.nChainWork <= nBestChainWork)
+        {
+            printf("header chain %d..%d has no more work than our best chain, dropping it\n",
+                   nHeaderChainStart, nHeaderChainStart + (int)vHeaderChain.size() - 1);
+            ClearHeaderChain();
+        }
+    }
+
+
     else if (strCommand == "tx")
     {
-        CDataStream vMsg(vRecv);
+        CPlainDataStream vMsg(vRecv);
         CTransaction tx;
         vRecv >> tx;
 
@@ -3052,12 +3738,19 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         CInv inv(MSG_BLOCK, block.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        mapBlocksRequested.erase(inv.hash);
+        pfrom->mapBlocksInFlight.erase(inv.hash);
+
         CValidationState state;
         if (ProcessBlock(state, pfrom, &block))
             mapAlreadyAskedFor.erase(inv);
         int nDoS;
         if (state.IsInvalid(nDoS))
+        {
             pfrom->Misbehaving(nDoS);
+            if (nDoS > 0)
+                TruncateHeaderChain(block, inv.hash);
+        }
     }
 
 
@@ -3200,6 +3893,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         }
     }
 
+    else if (strCommand == "dhtgetreqs")
+    {
+        std::vector<CDHTGetRequest> vReq;
+        vRecv >> vReq;
+
+        if( DhtProxy::dhtgetRequestReceived(vReq, pfrom) ) {
+            // ok
+        } else {
+            pfrom->Misbehaving(20);
+        }
+    }
+
     else if (strCommand == "dhtputreq")
     {
         CDHTPutRequest req;
@@ -3224,6 +3929,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         }
     }
 
+    else if (strCommand == "dhtgetreplies")
+    {
+        std::vector<CDHTGetReply> vReply;
+        vRecv >> vReply;
+
+        if( DhtProxy::dhtgetReplyReceived(vReply, pfrom) ) {
+            // ok
+        } else {
+            pfrom->Misbehaving(20);
+        }
+    }
+
     else if (strCommand == "nodhtproxy")
     {
         pfrom->fNoDhtProxy = true;
@@ -3304,7 +4021,7 @@ bool ProcessMessages(CNode* pfrom)
         unsigned int nMessageSize = hdr.nMessageSize;
 
         // Checksum
-        CDataStream& vRecv = msg.vRecv;
+        CPlainDataStream& vRecv = msg.vRecv;
         uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
         unsigned int nChecksum = 0;
         memcpy(&nChecksum, &hash, sizeof(nChecksum));
@@ -3384,7 +4101,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Start block sync
         if (pto->fStartSync && !fImporting && !fReindex) {
             pto->fStartSync = false;
-            PushGetBlocks(pto, pindexBest, uint256(0));
+            PushGetHeaders(pto);
         }
 
         // Resend wallet transactions that haven't gotten in a block yet
@@ -3511,6 +4228,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata
         //
         vector<CInv> vGetData;
+        if (!fImporting && !fReindex && !pto->fClient)
+            GetBlocksToDownload(pto, vGetData);
         int64 nNow = GetTime() * 1000000;
         while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
         {
@@ -3783,32 +4502,26 @@ CBlockTemplate* CreateNewBlock(std::vector<unsigned char> &salt)
         uint64 nBlockSize = 1000;
         uint64 nBlockTx = 0;
 
-        // Avoid duplicate usernames within the same block
-        set<uint256> uniqueUsers;
+        // Template candidates were checked against the best chain when they
+        // got in, and have unique usernames. only the new ones need checking.
+        mempool.updateTemplate();
+        // the bookkeeping itself is cheap to verify: every pool tx must be
+        // a candidate or dirty. if not, check all of them again.
+        if (!mempool.checkTemplate())
+            mempool.resetTemplate();
 
-        for (map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+        for (map<uint256, uint256>::iterator mi = mempool.mapTemplate.begin(); mi != mempool.mapTemplate.end(); )
         {
-            CTransaction& tx = (*mi).second;
-            if (tx.IsSpamMessage())
-                continue;
-
-            // This should never happen (unless replacement); all transactions in the memory are new
-            CTransaction txOld;
-            uint256 hashBlock = 0;
-            if( GetTransaction(tx.GetUsername(), txOld, hashBlock) ) {
-                if( !verifyDuplicateOrReplacementTx(tx, false, true) ) {
-                    printf("CreateNewBlock: mempool transaction already exists (%s)\n",
-                           tx.GetUsername().c_str());
-                    continue;
-                }
-            }
-
-            if( uniqueUsers.count(tx.GetUsernameHash()) ) {
-                printf("CreateNewBlock() : duplicate username (%s)\n", 
-                       tx.GetUsername().c_str());
+            // a candidate whose tx left the pool without updating the template
+            map<uint256, CTransaction>::iterator it = mempool.mapTx.find((*mi).second);
+            if (it == mempool.mapTx.end())
+            {
+                printf("CreateNewBlock(): dropping stale template candidate %s\n", (*mi).second.ToString().c_str());
+                mempool.mapTemplate.erase(mi++);
                 continue;
             }
-            uniqueUsers.insert(tx.GetUsernameHash());
+            const CTransaction& tx = (*it).second;
+            ++mi;
 
             // Size limits
             unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
@@ -3832,13 +4545,16 @@ CBlockTemplate* CreateNewBlock(std::vector<unsigned char> &salt)
         pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock);
         pblock->nNonce         = 0;
 
-        CBlockIndex indexDummy(*pblock);
-        indexDummy.pprev = pindexPrev;
-        indexDummy.nHeight = pindexPrev->nHeight + 1;
-        CCoinsViewCache viewNew(*pcoinsTip, true);
-        CValidationState state;
-        if (!ConnectBlock(*pblock, state, &indexDummy, viewNew, true))
-            throw std::runtime_error("CreateNewBlock() : ConnectBlock failed");
+        // full check of the template: as slow as building it the old way
+        if (GetBoolArg("-checkblocktemplate", false)) {
+            CBlockIndex indexDummy(*pblock);
+            indexDummy.pprev = pindexPrev;
+            indexDummy.nHeight = pindexPrev->nHeight + 1;
+            CCoinsViewCache viewNew(*pcoinsTip, true);
+            CValidationState state;
+            if (!ConnectBlock(*pblock, state, &indexDummy, viewNew, true))
+                throw std::runtime_error("CreateNewBlock() : ConnectBlock failed");
+        }
     }
 
     return pblocktemplate.release();
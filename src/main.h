@@ -12,6 +12,7 @@
 #include "script.h"
 
 #include <list>
+#include <boost/shared_ptr.hpp>
 
 class CWallet;
 class CBlock;
@@ -21,6 +22,7 @@ class CKeyItem;
 class CAddress;
 class CInv;
 class CNode;
+class CMappedFile;
 
 struct CBlockIndexWorkComparator;
 
@@ -58,6 +60,18 @@ static const int DEFAULT_BLOCK_PRIORITY_SIZE = 27000;
 static const int MAX_SPAM_MSG_SIZE = 140;
 /** The maximum size for username */
 static const unsigned int MAX_USERNAME_SIZE = 16;
+/** Number of headers sent in reply to getheaders */
+static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Number of blocks past our best block that may be downloaded during headers-first sync */
+static const int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Number of blocks that may be requested from a single peer at once */
+static const int MAX_BLOCKS_IN_FLIGHT = 16;
+/** Seconds after which a requested block is asked from another peer */
+static const int64 BLOCK_STALL_TIMEOUT = 10;
+/** Seconds the download window may wait for its first block before the header chain is dropped */
+static const int64 BLOCK_STALL_DROP = 120;
+/** Max number of blocks the pubkey snapshot may lag behind the best block before it is discarded */
+static const int PUBKEYCACHE_MAX_BEHIND = 2000;
 
 
 extern CScript COINBASE_FLAGS;
@@ -88,6 +102,7 @@ extern CCriticalSection cs_setpwalletRegistered;
 extern std::set<CWallet*> setpwalletRegistered;
 extern bool fImporting;
 extern bool fReindex;
+extern bool fUsernameRegistry;
 extern bool fBenchmark;
 extern int nScriptCheckThreads;
 extern unsigned int nCoinCacheSize;
@@ -129,6 +144,12 @@ void RegisterNodeSignals(CNodeSignals& nodeSignals);
 void UnregisterNodeSignals(CNodeSignals& nodeSignals);
 
 void PushGetBlocks(CNode* pnode, CBlockIndex* pindexBegin, uint256 hashEnd);
+/** Ask pnode for the headers following the best header we know of */
+void PushGetHeaders(CNode* pnode);
+/** Run an instance of the proof-of-work checking thread */
+void ThreadPoWCheck();
+/** Run an instance of the username checking thread, used by ConnectBlock */
+void ThreadUsernameCheck();
 
 /** Process an incoming block */
 bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp = NULL);
@@ -136,6 +157,8 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
 bool CheckDiskSpace(uint64 nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+/** Serialized block at pos in the memory mapped block file, [pbegin, pend). NULL if it can't be mapped */
+boost::shared_ptr<CMappedFile> GetMappedBlock(const CDiskBlockPos& pos, const char*& pbegin, const char*& pend);
 /** Open an undo file (rev?????.dat) */
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Import blocks from an external file */
@@ -144,6 +167,10 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
+/** Load the pubkey snapshot, dropping users changed by blocks connected after it */
+void LoadPubKeyCache();
+/** Save the pubkey snapshot for the current best block */
+void FlushPubKeyCache();
 /** Unload database information */
 void UnloadBlockIndex();
 /** Verify consistency of the block and coin databases */
@@ -177,7 +204,7 @@ bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core */
 std::string GetWarnings(std::string strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
-bool GetTransaction(const std::string &username, CTransaction &tx, uint256 &hashBlock, int maxHeight = -1);
+bool GetTransaction(const std::string &username, CTransaction &tx, uint256 &hashBlock, int maxHeight = -1, int *pnHeight = NULL);
 /** Verify duplicate or replacement transactions */
 bool verifyDuplicateOrReplacementTx(CTransaction &tx, bool checkDuplicate, bool checkReplacement, int maxHeight = -1, bool removeOrphan = false);
 /** Connect/disconnect blocks until pindexNew is the new tip of the active block chain */
@@ -500,7 +527,7 @@ public:
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckPOW = true);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 
 
@@ -820,6 +847,16 @@ struct CBlockIndexWorkComparator
     }
 };
 
+/** A header of the headers-first sync header chain, indexed like the block
+ *  it stands for, so difficulty and chain work can be checked before we have
+ *  the block. index.phashBlock points to hash. */
+class CHeaderChainEntry
+{
+public:
+    uint256 hash;
+    CBlockIndex index;
+};
+
 
 
 /** Used to marshal pointers into hashes for db storage. */
@@ -983,6 +1020,12 @@ public:
         return vHave.empty();
     }
 
+    /** Puts hash in front of the locator, e.g. a header we don't have the block of yet. */
+    void Prepend(const uint256& hash)
+    {
+        vHave.insert(vHave.begin(), hash);
+    }
+
     /** Given a block initialises the locator to that point in the chain. */
     void Set(const CBlockIndex* pindex);
     /** Returns the distance in blocks this locator is from our chain head. */
@@ -1008,11 +1051,26 @@ public:
     mutable CCriticalSection cs;
     std::map<uint256, CTransaction> mapTx; // [MF] hash is txhash again
 
+    // [MF] block template candidates: at most one transaction per username,
+    // checked against the best chain. kept up to date by accept/remove and
+    // on block connect/disconnect, so CreateNewBlock needs no tx index reads.
+    std::map<uint256, uint256> mapTemplate; // username hash -> txhash
+    // transactions to be checked by updateTemplate
+    std::set<uint256> setTemplateDirty;
+
     bool accept(CValidationState &state, CTransaction &tx, bool fLimitFree, bool* pfMissingInputs);
     bool addUnchecked(const uint256& userhash, CTransaction &tx);
     bool remove(const CTransaction &tx, bool fRecursive = false);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
+    // the template transaction of this username must be checked again
+    void invalidateTemplate(const uint256& userhash);
+    // check the dirty transactions whose username has no candidate yet
+    void updateTemplate();
+    // false if mapTemplate/setTemplateDirty don't match mapTx
+    bool checkTemplate();
+    // make every transaction dirty and check them all again
+    void resetTemplate();
 
     unsigned long size()
     {
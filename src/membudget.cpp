@@ -0,0 +1,131 @@
+#include "membudget.h"
+#include "util.h"
+
+#include <vector>
+
+CMemoryBudget memoryBudget;
+
+// share of the total (percent) assigned to each component. the remaining
+// 8% is left for what is not accounted for (user data, mentions, bloom filters...)
+static const int vShare[MEM_NUM_COMPONENTS] = {
+    4,  // MEM_BLOCKTREE_DB
+    18, // MEM_COINS_DB
+    18, // MEM_COINS_CACHE
+    8,  // MEM_SWARM_DB
+    16, // MEM_POST_CACHE
+    25, // MEM_TORRENT_CACHE
+    3,  // MEM_DHT_STORAGE
+};
+
+CMemoryBudget::CMemoryBudget() : nTotal(0)
+{
+    for (int c = 0; c < MEM_NUM_COMPONENTS; c++)
+        vLimit[c] = 0;
+}
+
+void CMemoryBudget::SetTotal(size_t nTotalIn)
+{
+    LOCK(cs);
+    nTotal = nTotalIn;
+    for (int c = 0; c < MEM_NUM_COMPONENTS; c++)
+        vLimit[c] = nTotal / 100 * vShare[c];
+}
+
+size_t CMemoryBudget::GetTotal() const
+{
+    LOCK(cs);
+    return nTotal;
+}
+
+void CMemoryBudget::SetLimit(MemoryComponent c, size_t nLimit)
+{
+    LOCK(cs);
+    vLimit[c] = nLimit;
+}
+
+size_t CMemoryBudget::GetLimit(MemoryComponent c) const
+{
+    LOCK(cs);
+    return vLimit[c];
+}
+
+void CMemoryBudget::Register(MemoryComponent c, UsageFunction usage, ResizeFunction resize)
+{
+    LOCK(cs);
+    vUsage[c] = usage;
+    vResize[c] = resize;
+}
+
+void CMemoryBudget::Unregister(MemoryComponent c)
+{
+    LOCK(cs);
+    vUsage[c].clear();
+    vResize[c].clear();
+}
+
+size_t CMemoryBudget::GetUsage(MemoryComponent c) const
+{
+    UsageFunction usage;
+    {
+        LOCK(cs);
+        if (!vUsage[c])
+            return vLimit[c];
+        usage = vUsage[c];
+    }
+    // called without cs: the component takes its own locks
+    return usage();
+}
+
+bool CMemoryBudget::IsResizable(MemoryComponent c) const
+{
+    LOCK(cs);
+    return !vResize[c].empty();
+}
+
+void CMemoryBudget::Rebalance(size_t nTotalIn)
+{
+    std::vector<std::pair<ResizeFunction, size_t> > vToResize;
+    {
+        LOCK(cs);
+        nTotal = nTotalIn;
+
+        size_t nFixed = 0;
+        int nShares = 0;
+        for (int c = 0; c < MEM_NUM_COMPONENTS; c++) {
+            if (vResize[c])
+                nShares += vShare[c];
+            else
+                nFixed += vLimit[c];
+        }
+        if (!nShares)
+            return;
+
+        // fixed components and the unassigned part are kept out of the split
+        size_t nReserved = nFixed + nTotal / 100 * 8;
+        size_t nAvailable = nTotal > nReserved ? nTotal - nReserved : 0;
+        for (int c = 0; c < MEM_NUM_COMPONENTS; c++) {
+            if (!vResize[c])
+                continue;
+            vLimit[c] = nAvailable / nShares * vShare[c];
+            vToResize.push_back(std::make_pair(vResize[c], vLimit[c]));
+        }
+    }
+    printf("CMemoryBudget::Rebalance: total %zu MiB, %zu resizable components\n",
+           nTotalIn >> 20, vToResize.size());
+    for (unsigned int i = 0; i < vToResize.size(); i++)
+        vToResize[i].first(vToResize[i].second);
+}
+
+const char *CMemoryBudget::GetName(MemoryComponent c)
+{
+    switch (c) {
+    case MEM_BLOCKTREE_DB:  return "blocktreedb";
+    case MEM_COINS_DB:      return "coinsdb";
+    case MEM_COINS_CACHE:   return "coinscache";
+    case MEM_SWARM_DB:      return "swarmdb";
+    case MEM_POST_CACHE:    return "postcache";
+    case MEM_TORRENT_CACHE: return "torrentcache";
+    case MEM_DHT_STORAGE:   return "dhtstorage";
+    default:                return "unknown";
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef MEMBUDGET_H
+#define MEMBUDGET_H
+
+#include "sync.h"
+
+#include <boost/function.hpp>
+
+// Node-wide memory budget.
+//
+// A single -maxmemory total is split among the caches of the different
+// subsystems. Components register a function reporting their current usage
+// and, if their cache may be resized while running, a function applying a
+// new limit (in bytes). Caches that can only be sized at open time (leveldb)
+// keep their startup allocation and are reported with it.
+
+enum MemoryComponent
+{
+    MEM_BLOCKTREE_DB,   // block index leveldb cache
+    MEM_COINS_DB,       // coins leveldb cache
+    MEM_COINS_CACHE,    // in-memory coins view (pcoinsTip)
+    MEM_SWARM_DB,       // swarm (posts) leveldb cache
+    MEM_POST_CACHE,     // decoded posts LRU
+    MEM_TORRENT_CACHE,  // libtorrent disk read cache
+    MEM_DHT_STORAGE,    // items stored by the local dht node
+    MEM_NUM_COMPONENTS
+};
+
+// rough in-memory cost of a single cached element, used to convert
+// byte limits into element counts
+static const size_t MEM_COIN_SIZE = 300;
+static const size_t MEM_POST_SIZE = 1024;
+static const size_t MEM_TORRENT_BLOCK_SIZE = 16 * 1024;
+static const size_t MEM_DHT_ITEM_SIZE = 2048;
+
+class CMemoryBudget
+{
+public:
+    typedef boost::function<size_t ()> UsageFunction;
+    typedef boost::function<void (size_t)> ResizeFunction;
+
+    CMemoryBudget();
+
+    // split nTotal bytes among components according to their shares
+    void SetTotal(size_t nTotal);
+    size_t GetTotal() const;
+
+    // override the share of a component sized by its own option
+    void SetLimit(MemoryComponent c, size_t nLimit);
+    size_t GetLimit(MemoryComponent c) const;
+
+    // without a resize function the component keeps its current limit
+    void Register(MemoryComponent c, UsageFunction usage, ResizeFunction resize = ResizeFunction());
+    void Unregister(MemoryComponent c);
+
+    // usage as reported by the component (its limit if it can't measure it)
+    size_t GetUsage(MemoryComponent c) const;
+    bool IsResizable(MemoryComponent c) const;
+
+    // set a new total: fixed components keep their allocation and the rest
+    // is split among the resizable ones, which are resized immediately.
+    void Rebalance(size_t nTotal);
+
+    static const char *GetName(MemoryComponent c);
+
+private:
+    mutable CCriticalSection cs;
+    size_t nTotal;
+    size_t vLimit[MEM_NUM_COMPONENTS];
+    UsageFunction vUsage[MEM_NUM_COMPONENTS];
+    ResizeFunction vResize[MEM_NUM_COMPONENTS];
+};
+
+extern CMemoryBudget memoryBudget;
+
+#endif // MEMBUDGET_H
@@ -92,7 +92,7 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CPlainDataStream> mapRelay;
 extern std::deque<std::pair<int64, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64> mapAlreadyAskedFor;
@@ -128,11 +128,11 @@ class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    CPlainDataStream hdrbuf;        // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CPlainDataStream vRecv;         // received message data
     unsigned int nDataPos;
 
     CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn) {
@@ -170,11 +170,11 @@ public:
     // socket
     uint64 nServices;
     SOCKET hSocket;
-    CDataStream ssSend;
+    CPlainDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64 nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CPlainSerializeData> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -222,6 +222,8 @@ public:
     uint256 hashLastGetBlocksEnd;
     int nStartingHeight;
     bool fStartSync;
+    // headers-first sync: blocks requested from this node, and when
+    std::map<uint256, int64> mapBlocksInFlight;
 
     // flood relay
     std::vector<CAddress> vAddrToSend;
@@ -444,7 +446,7 @@ public:
             printf("(%d bytes)\n", nSize);
         }
 
-        std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
+        std::deque<CPlainSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CPlainSerializeData());
         ssSend.GetAndClear(*it);
         nSendSize += (*it).size();
 
@@ -472,6 +474,22 @@ public:
         }
     }
 
+    // payload already serialized
+    void PushRawMessage(const char* pszCommand, const char* pbegin, const char* pend)
+    {
+        try
+        {
+            BeginMessage(pszCommand);
+            ssSend.write(pbegin, pend - pbegin);
+            EndMessage();
+        }
+        catch (...)
+        {
+            AbortMessage();
+            throw;
+        }
+    }
+
     template<typename T1>
     void PushMessage(const char* pszCommand, const T1& a1)
     {
@@ -647,6 +665,6 @@ public:
 
 class CTransaction;
 void RelayTransaction(const CTransaction& tx, const uint256& txhash);
-void RelayTransaction(const CTransaction& tx, const uint256& txhash, const CDataStream& ss);
+void RelayTransaction(const CTransaction& tx, const uint256& txhash, const CPlainDataStream& ss);
 
 #endif
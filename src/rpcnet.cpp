@@ -4,6 +4,7 @@
 
 #include "net.h"
 #include "bitcoinrpc.h"
+#include "membudget.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -216,3 +217,40 @@ Value getaddednodeinfo(const Array& params, bool fHelp)
     return ret;
 }
 
+Value getmemoryinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getmemoryinfo [maxmemory]\n"
+            "Returns the memory budget and the usage of each cache (in bytes).\n"
+            "If [maxmemory] (in megabytes) is given the budget is changed and\n"
+            "resizable caches are rebalanced at once; database caches keep\n"
+            "their size until restart.");
+
+    if (params.size() > 0) {
+        boost::int64_t nMaxMemory = params[0].get_int64();
+        if (nMaxMemory < 16)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "maxmemory cannot be less than 16 MiB");
+        memoryBudget.Rebalance((size_t)nMaxMemory << 20);
+    }
+
+    Object components;
+    size_t nUsage = 0;
+    for (int c = 0; c < MEM_NUM_COMPONENTS; c++) {
+        MemoryComponent comp = (MemoryComponent)c;
+        size_t nComponentUsage = memoryBudget.GetUsage(comp);
+        nUsage += nComponentUsage;
+
+        Object obj;
+        obj.push_back(Pair("limit", (boost::int64_t)memoryBudget.GetLimit(comp)));
+        obj.push_back(Pair("usage", (boost::int64_t)nComponentUsage));
+        obj.push_back(Pair("resizable", memoryBudget.IsResizable(comp)));
+        components.push_back(Pair(CMemoryBudget::GetName(comp), obj));
+    }
+
+    Object ret;
+    ret.push_back(Pair("maxmemory", (boost::int64_t)memoryBudget.GetTotal()));
+    ret.push_back(Pair("usage", (boost::int64_t)nUsage));
+    ret.push_back(Pair("components", components));
+    return ret;
+}
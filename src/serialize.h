@@ -26,7 +26,7 @@ typedef long long  int64;
 typedef unsigned long long  uint64;
 
 class CScript;
-class CDataStream;
+template<typename SerializeType> class CBaseDataStream;
 class CAutoFile;
 static const unsigned int MAX_SIZE = 0x02000000;
 
@@ -790,16 +790,21 @@ struct ser_streamplaceholder
 
 
 typedef std::vector<char, zero_after_free_allocator<char> > CSerializeData;
+typedef std::vector<char> CPlainSerializeData;
 
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
  * Fills with data in linear time; some stringstream implementations take N^2 time.
+ *
+ * CDataStream wipes its buffer when freed, as it may hold key material.
+ * CPlainDataStream doesn't, it is meant for network and database data.
  */
-class CDataStream
+template<typename SerializeType>
+class CBaseDataStream
 {
 protected:
-    typedef CSerializeData vector_type;
+    typedef SerializeType vector_type;
     vector_type vch;
     unsigned int nReadPos;
     short state;
@@ -808,46 +813,49 @@ public:
     int nType;
     int nVersion;
 
-    typedef vector_type::allocator_type   allocator_type;
-    typedef vector_type::size_type        size_type;
-    typedef vector_type::difference_type  difference_type;
-    typedef vector_type::reference        reference;
-    typedef vector_type::const_reference  const_reference;
-    typedef vector_type::value_type       value_type;
-    typedef vector_type::iterator         iterator;
-    typedef vector_type::const_iterator   const_iterator;
-    typedef vector_type::reverse_iterator reverse_iterator;
-
-    explicit CDataStream(int nTypeIn, int nVersionIn)
+    typedef typename vector_type::allocator_type   allocator_type;
+    typedef typename vector_type::size_type        size_type;
+    typedef typename vector_type::difference_type  difference_type;
+    typedef typename vector_type::reference        reference;
+    typedef typename vector_type::const_reference  const_reference;
+    typedef typename vector_type::value_type       value_type;
+    typedef typename vector_type::iterator         iterator;
+    typedef typename vector_type::const_iterator   const_iterator;
+    typedef typename vector_type::reverse_iterator reverse_iterator;
+
+    explicit CBaseDataStream(int nTypeIn, int nVersionIn)
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
+    CBaseDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
     {
         Init(nTypeIn, nVersionIn);
     }
 
 #if !defined(_MSC_VER) || _MSC_VER >= 1300
-    CDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
+    CBaseDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
     {
         Init(nTypeIn, nVersionIn);
     }
 #endif
 
-    CDataStream(const vector_type& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    template<typename Allocator>
+    CBaseDataStream(const std::vector<char, Allocator>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    CBaseDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : vch((char*)&vchIn.begin()[0], (char*)&vchIn.end()[0])
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : vch((char*)&vchIn.begin()[0], (char*)&vchIn.end()[0])
+    // copy the unread part of a stream using the other buffer type
+    template<typename OtherType>
+    explicit CBaseDataStream(const CBaseDataStream<OtherType>& other) : vch(other.begin(), other.end())
     {
-        Init(nTypeIn, nVersionIn);
+        Init(other.nType, other.nVersion);
     }
 
     void Init(int nTypeIn, int nVersionIn)
@@ -859,15 +867,15 @@ public:
         exceptmask = std::ios::badbit | std::ios::failbit;
     }
 
-    CDataStream& operator+=(const CDataStream& b)
+    CBaseDataStream& operator+=(const CBaseDataStream& b)
     {
         vch.insert(vch.end(), b.begin(), b.end());
         return *this;
     }
 
-    friend CDataStream operator+(const CDataStream& a, const CDataStream& b)
+    friend CBaseDataStream operator+(const CBaseDataStream& a, const CBaseDataStream& b)
     {
-        CDataStream ret = a;
+        CBaseDataStream ret = a;
         ret += b;
         return (ret);
     }
@@ -992,7 +1000,7 @@ public:
     void clear(short n)          { state = n; }  // name conflict with vector clear()
     short exceptions()           { return exceptmask; }
     short exceptions(short mask) { short prev = exceptmask; exceptmask = mask; setstate(0, "CDataStream"); return prev; }
-    CDataStream* rdbuf()         { return this; }
+    CBaseDataStream* rdbuf()     { return this; }
     int in_avail()               { return size(); }
 
     void SetType(int n)          { nType = n; }
@@ -1002,7 +1010,7 @@ public:
     void ReadVersion()           { *this >> nVersion; }
     void WriteVersion()          { *this << nVersion; }
 
-    CDataStream& read(char* pch, int nSize)
+    CBaseDataStream& read(char* pch, int nSize)
     {
         // Read from the beginning of the buffer
         assert(nSize >= 0);
@@ -1025,7 +1033,7 @@ public:
         return (*this);
     }
 
-    CDataStream& ignore(int nSize)
+    CBaseDataStream& ignore(int nSize)
     {
         // Ignore from the beginning of the buffer
         assert(nSize >= 0);
@@ -1045,7 +1053,7 @@ public:
         return (*this);
     }
 
-    CDataStream& write(const char* pch, int nSize)
+    CBaseDataStream& write(const char* pch, int nSize)
     {
         // Write to the end of the buffer
         assert(nSize >= 0);
@@ -1069,7 +1077,7 @@ public:
     }
 
     template<typename T>
-    CDataStream& operator<<(const T& obj)
+    CBaseDataStream& operator<<(const T& obj)
     {
         // Serialize to this stream
         ::Serialize(*this, obj, nType, nVersion);
@@ -1077,16 +1085,93 @@ public:
     }
 
     template<typename T>
-    CDataStream& operator>>(T& obj)
+    CBaseDataStream& operator>>(T& obj)
     {
         // Unserialize from this stream
         ::Unserialize(*this, obj, nType, nVersion);
         return (*this);
     }
 
-    void GetAndClear(CSerializeData &data) {
+    void GetAndClear(vector_type &data) {
         vch.swap(data);
-        CSerializeData().swap(vch);
+        vector_type().swap(vch);
+    }
+};
+
+typedef CBaseDataStream<CSerializeData> CDataStream;
+typedef CBaseDataStream<CPlainSerializeData> CPlainDataStream;
+
+/** Read-only stream over a buffer owned by the caller.
+ *
+ * Deserializes in place, without first copying the data into a stream.
+ * The buffer must outlive the stream.
+ */
+class CSpanStream
+{
+private:
+    const char* pbegin;
+    const char* pend;
+    short state;
+    short exceptmask;
+public:
+    int nType;
+    int nVersion;
+
+    CSpanStream(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn) :
+        pbegin(pbeginIn), pend(pendIn), state(0), exceptmask(std::ios::badbit | std::ios::failbit),
+        nType(nTypeIn), nVersion(nVersionIn) {}
+
+    // unread part of the buffer
+    const char* begin() const    { return pbegin; }
+    const char* end() const      { return pend; }
+    size_t size() const          { return pend - pbegin; }
+    bool empty() const           { return pbegin == pend; }
+
+    void setstate(short bits, const char* psz)
+    {
+        state |= bits;
+        if (state & exceptmask)
+            throw std::ios_base::failure(psz);
+    }
+
+    bool eof() const             { return empty(); }
+    bool fail() const            { return state & (std::ios::badbit | std::ios::failbit); }
+    bool good() const            { return !eof() && (state == 0); }
+    int GetType()                { return nType; }
+    int GetVersion()             { return nVersion; }
+
+    CSpanStream& read(char* pch, int nSize)
+    {
+        assert(nSize >= 0);
+        if ((size_t)nSize > size())
+        {
+            setstate(std::ios::failbit, "CSpanStream::read() : end of data");
+            memset(pch, 0, nSize);
+            nSize = size();
+        }
+        memcpy(pch, pbegin, nSize);
+        pbegin += nSize;
+        return (*this);
+    }
+
+    CSpanStream& ignore(int nSize)
+    {
+        assert(nSize >= 0);
+        if ((size_t)nSize > size())
+        {
+            setstate(std::ios::failbit, "CSpanStream::ignore() : end of data");
+            nSize = size();
+        }
+        pbegin += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CSpanStream& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
     }
 };
 
@@ -0,0 +1,76 @@
+//
+// Unit tests for the headers-first sync download window
+//
+#include <deque>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "chainparams.h"
+#include "main.h"
+#include "net.h"
+#include "util.h"
+
+// Tests these internal-to-main.cpp methods:
+extern std::deque<CHeaderChainEntry> vHeaderChain;
+extern int nHeaderChainStart;
+extern CService addrHeaderChainFrom;
+extern void ClearHeaderChain();
+extern void GetBlocksToDownload(CNode* pto, std::vector<CInv>& vGetData);
+
+static CService peer(uint32_t i)
+{
+    struct in_addr s;
+    s.s_addr = i;
+    return CService(CNetAddr(s), Params().GetDefaultPort());
+}
+
+BOOST_AUTO_TEST_SUITE(headerssync_tests)
+
+BOOST_AUTO_TEST_CASE(headerssync_stall)
+{
+    ClearHeaderChain();
+
+    // a header chain with more work than ours, served by node1
+    vHeaderChain.resize(1);
+    CHeaderChainEntry& entry = vHeaderChain.back();
+    entry.hash = GetRandHash();
+    entry.index.phashBlock = &entry.hash;
+    entry.index.pprev = pindexBest;
+    entry.index.nHeight = nBestHeight + 1;
+    entry.index.nChainWork = nBestChainWork + 1;
+    nHeaderChainStart = nBestHeight + 1;
+
+    CNode node1(INVALID_SOCKET, CAddress(peer(0xa0b0c001)), "", true);
+    CNode node2(INVALID_SOCKET, CAddress(peer(0xa0b0c002)), "", true);
+    addrHeaderChainFrom = node1.addr;
+
+    int64 nStartTime = GetTime();
+    SetMockTime(nStartTime);
+    std::vector<CInv> vGetData;
+    GetBlocksToDownload(&node1, vGetData);
+    BOOST_CHECK(vGetData.size() == 1);
+    BOOST_CHECK(vGetData[0].hash == entry.hash);
+
+    // nobody delivers the first block: the header chain is dropped
+    SetMockTime(nStartTime + BLOCK_STALL_DROP + 1);
+    vGetData.clear();
+    GetBlocksToDownload(&node1, vGetData);
+    BOOST_CHECK(vHeaderChain.empty());
+    BOOST_CHECK(vGetData.empty());
+
+    // headers are asked again, not from the peer that served the dropped chain
+    GetBlocksToDownload(&node1, vGetData);
+    BOOST_CHECK(node1.vSendMsg.empty());
+    GetBlocksToDownload(&node2, vGetData);
+    BOOST_CHECK(!node2.vSendMsg.empty());
+
+    // only once
+    size_t nSendMsg = node2.vSendMsg.size();
+    GetBlocksToDownload(&node2, vGetData);
+    BOOST_CHECK(node2.vSendMsg.size() == nSendMsg);
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
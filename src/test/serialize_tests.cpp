@@ -42,4 +42,80 @@ BOOST_AUTO_TEST_CASE(varints)
 
 }
 
+BOOST_AUTO_TEST_CASE(plaindatastream)
+{
+    std::vector<int> v;
+    v.push_back(1);
+    v.push_back(-2);
+    v.push_back(300000);
+
+    CPlainDataStream ss(SER_DISK, 0);
+    ss << string("twister") << v << (int64)0x0102030405060708LL << VARINT(123456);
+
+    string str;
+    std::vector<int> v2;
+    int64 n = 0;
+    int i = 0;
+    ss >> str >> v2 >> n >> VARINT(i);
+    BOOST_CHECK(str == "twister");
+    BOOST_CHECK(v2 == v);
+    BOOST_CHECK(n == 0x0102030405060708LL);
+    BOOST_CHECK(i == 123456);
+    BOOST_CHECK(ss.empty());
+}
+
+BOOST_AUTO_TEST_CASE(spanstream)
+{
+    CDataStream ss(SER_DISK, 0);
+    ss << string("abc") << 42;
+    std::vector<char> buf(ss.begin(), ss.end());
+
+    string str;
+    int n = 0;
+    CSpanStream span(&buf[0], &buf[0] + buf.size(), SER_DISK, 0);
+    span >> str >> n;
+    BOOST_CHECK(str == "abc");
+    BOOST_CHECK(n == 42);
+    BOOST_CHECK(span.empty());
+
+    // reading past the end throws, without consuming the bytes left
+    CSpanStream spanShort(&buf[0], &buf[0] + buf.size() - 1, SER_DISK, 0);
+    spanShort >> str;
+    BOOST_CHECK_THROW(spanShort >> n, std::ios_base::failure);
+    BOOST_CHECK(spanShort.fail());
+    BOOST_CHECK(spanShort.size() == sizeof(n) - 1);
+
+    // a length prefix longer than the data
+    CDataStream ssLong(SER_DISK, 0);
+    ssLong << string(100, 'x');
+    std::vector<char> bufLong(ssLong.begin(), ssLong.begin() + 10);
+    CSpanStream spanLong(&bufLong[0], &bufLong[0] + bufLong.size(), SER_DISK, 0);
+    BOOST_CHECK_THROW(spanLong >> str, std::ios_base::failure);
+    BOOST_CHECK_THROW(spanLong.ignore(bufLong.size() + 1), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(datastream_copy)
+{
+    CDataStream ss(SER_NETWORK, 7);
+    ss << 1 << string("unread");
+    int n = 0;
+    ss >> n;
+
+    // only the unread part is copied, type and version come along
+    CPlainDataStream plain(ss);
+    BOOST_CHECK(plain.nType == SER_NETWORK);
+    BOOST_CHECK(plain.nVersion == 7);
+    BOOST_CHECK(plain.size() == ss.size());
+    BOOST_CHECK(plain.str() == ss.str());
+
+    CDataStream ss2(plain);
+    string str;
+    plain >> str;
+    BOOST_CHECK(str == "unread");
+    BOOST_CHECK(plain.empty());
+    ss2 >> str;
+    BOOST_CHECK(str == "unread");
+    BOOST_CHECK(ss2.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,78 @@
+//
+// Unit tests for the block template candidates kept by the memory pool
+//
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+
+static CTransaction UserTx(const std::string& username, unsigned int nNonce)
+{
+    CTransaction tx;
+    tx.userName = CScript() << std::vector<unsigned char>(username.begin(), username.end());
+    tx.nNonce = nNonce;
+    return tx;
+}
+
+BOOST_AUTO_TEST_SUITE(template_tests)
+
+BOOST_AUTO_TEST_CASE(template_bookkeeping)
+{
+    CTxMemPool pool;
+    LOCK(pool.cs);
+
+    // the first tx of each username is the candidate, the others wait
+    CTransaction tx1 = UserTx("alice", 1), tx2 = UserTx("alice", 2), tx3 = UserTx("bob", 3);
+    uint256 hash1 = tx1.GetHash(), hash2 = tx2.GetHash(), hash3 = tx3.GetHash();
+    pool.addUnchecked(hash1, tx1);
+    pool.addUnchecked(hash2, tx2);
+    pool.addUnchecked(hash3, tx3);
+    BOOST_CHECK(pool.mapTemplate.size() == 2);
+    BOOST_CHECK(pool.mapTemplate[tx1.GetUsernameHash()] == hash1);
+    BOOST_CHECK(pool.mapTemplate[tx3.GetUsernameHash()] == hash3);
+    BOOST_CHECK(pool.setTemplateDirty.size() == 1 && pool.setTemplateDirty.count(hash2));
+    BOOST_CHECK(pool.checkTemplate());
+
+    // nothing changes while alice's candidate is still there
+    pool.updateTemplate();
+    BOOST_CHECK(pool.mapTemplate[tx1.GetUsernameHash()] == hash1);
+    BOOST_CHECK(pool.setTemplateDirty.count(hash2));
+
+    // alice's candidate is mined: the waiting tx takes its place
+    pool.remove(tx1);
+    BOOST_CHECK(!pool.mapTemplate.count(tx1.GetUsernameHash()));
+    BOOST_CHECK(pool.checkTemplate());
+    pool.updateTemplate();
+    BOOST_CHECK(pool.mapTemplate[tx2.GetUsernameHash()] == hash2);
+    BOOST_CHECK(pool.setTemplateDirty.empty());
+    BOOST_CHECK(pool.checkTemplate());
+
+    // a reorganization changed bob: his candidate is checked again
+    pool.invalidateTemplate(tx3.GetUsernameHash());
+    BOOST_CHECK(!pool.mapTemplate.count(tx3.GetUsernameHash()));
+    BOOST_CHECK(pool.setTemplateDirty.count(hash3));
+    BOOST_CHECK(pool.checkTemplate());
+    pool.updateTemplate();
+    BOOST_CHECK(pool.mapTemplate[tx3.GetUsernameHash()] == hash3);
+    BOOST_CHECK(pool.checkTemplate());
+
+    // a tx removed while dirty leaves nothing behind
+    CTransaction tx4 = UserTx("bob", 4);
+    uint256 hash4 = tx4.GetHash();
+    pool.addUnchecked(hash4, tx4);
+    BOOST_CHECK(pool.setTemplateDirty.count(hash4));
+    pool.remove(tx4);
+    BOOST_CHECK(pool.setTemplateDirty.empty());
+    BOOST_CHECK(pool.checkTemplate());
+
+    // broken bookkeeping is detected and rebuilt
+    pool.mapTemplate.erase(tx3.GetUsernameHash());
+    BOOST_CHECK(!pool.checkTemplate());
+    pool.resetTemplate();
+    BOOST_CHECK(pool.mapTemplate.size() == 2);
+    BOOST_CHECK(pool.mapTemplate[tx3.GetUsernameHash()] == hash3);
+    BOOST_CHECK(pool.checkTemplate());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
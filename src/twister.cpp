@@ -2,6 +2,7 @@
 
 #include "twister_utils.h"
 #include "dhtproxy.h"
+#include "membudget.h"
 
 #include "main.h"
 #include "init.h"
@@ -58,6 +59,8 @@ enum ExpireResType { SimpleNoExpire, NumberedNoExpire, PostNoExpireRecent };
 static map<std::string, ExpireResType> m_noExpireResources;
 static map<std::string, torrent_handle> m_userTorrent;
 static boost::scoped_ptr<CLevelDB> m_swarmDb;
+static std::map<std::string, std::vector<char> > m_resumeData; // loaded at startup, consumed by startTorrentUser
+static std::set<std::string> m_pendingTorrents; // async_add_torrent issued, waiting for add_torrent_alert
 static int m_threadsToJoin;
 
 static CCriticalSection cs_spamMsg;
@@ -70,6 +73,9 @@ static std::map<std::string,UserData> m_users;
 static CCriticalSection cs_seenHashtags;
 static std::map<std::string,double> m_seenHashtags;
 
+static CCriticalSection cs_postCache;
+static boost::scoped_ptr<PostCache> m_postCache;
+
 const double hashtagHalfLife      = 8*60*60;    // Halve votes within 8 hours (sec)
 const double hashtagExpiration    = 7*24*60*60; // Remove a hashtag from the list after ~ hashtagExpiration*count (sec)
 const int    hashtagTimerInterval = 60;         // Timer interval (sec)
@@ -132,6 +138,33 @@ void dhtgetMapPost(sha1_hash &ih, const alert &a)
     }
 }
 
+void userTorrentParams(std::string const &username, add_torrent_params &tparams)
+{
+    sha1_hash ih = dhtTargetHash(username, "tracker", "m");
+
+    tparams.info_hash = ih;
+    tparams.name = username;
+    boost::filesystem::path torrentPath = GetDataDir() / "swarm";
+    tparams.save_path= torrentPath.string();
+    boost::system::error_code ec;
+    boost::filesystem::create_directory(torrentPath, ec);
+    if (ec) {
+        fprintf(stderr, "failed to create directory '%s': %s\n", torrentPath.string().c_str(), ec.message().c_str());
+    }
+    {
+        LOCK(cs_twister);
+        std::map<std::string, std::vector<char> >::iterator itResume = m_resumeData.find(username);
+        if( itResume != m_resumeData.end() ) {
+            tparams.resume_data.swap(itResume->second);
+            m_resumeData.erase(itResume);
+            return;
+        }
+    }
+    // legacy: one .resume file per torrent
+    std::string filename = combine_path(tparams.save_path, to_hex(ih.to_string()) + ".resume");
+    load_file(filename.c_str(), tparams.resume_data);
+}
+
 torrent_handle startTorrentUser(std::string const &username, bool following)
 {
     bool userInTxDb = usernameExists(username); // keep this outside cs_twister to avoid deadlock
@@ -141,21 +174,9 @@ torrent_handle startTorrentUser(std::string const &username, bool following)
 
     LOCK(cs_twister);
     if( !m_userTorrent.count(username) ) {
-        sha1_hash ih = dhtTargetHash(username, "tracker", "m");
-
         printf("adding torrent for [%s,tracker]\n", username.c_str());
         add_torrent_params tparams;
-        tparams.info_hash = ih;
-        tparams.name = username;
-        boost::filesystem::path torrentPath = GetDataDir() / "swarm";
-        tparams.save_path= torrentPath.string();
-        boost::system::error_code ec;
-        boost::filesystem::create_directory(torrentPath, ec);
-        if (ec) {
-            fprintf(stderr, "failed to create directory '%s': %s\n", torrentPath.string().c_str(), ec.message().c_str());
-        }
-        std::string filename = combine_path(tparams.save_path, to_hex(ih.to_string()) + ".resume");
-        load_file(filename.c_str(), tparams.resume_data);
+        userTorrentParams(username, tparams);
 
         m_userTorrent[username] = ses->add_torrent(tparams);
         if( !following ) {
@@ -171,6 +192,52 @@ torrent_handle startTorrentUser(std::string const &username, bool following)
     return m_userTorrent[username];
 }
 
+// bulk startup path for followed users: names are checked against the
+// in-memory username index, torrents are queued with async_add_torrent
+// (most recently active first, by the last_download_time saved in the
+// resume data) and their handles are stored as the add_torrent_alerts
+// arrive in ThreadSessionAlerts.
+void startTorrentUsers(std::set<std::string> const &usernames)
+{
+    boost::shared_ptr<session> ses(m_ses);
+    if( !ses )
+        return;
+
+    bool useIndex = usernameIndex.Size() > 0;
+    std::multimap<int64, add_torrent_params> torrentsToAdd;
+    BOOST_FOREACH(std::string const &username, usernames) {
+        if( getTorrentUser(username).is_valid() )
+            continue;
+        if( useIndex ? !usernameIndex.Exists(username) : !usernameExists(username) )
+            continue;
+
+        add_torrent_params tparams;
+        userTorrentParams(username, tparams);
+
+        // time the last piece was downloaded, newest first (torrents without
+        // it in their resume data go last)
+        int64 lastActivity = 0;
+        lazy_entry rd;
+        libtorrent::error_code ec;
+        if( tparams.resume_data.size() &&
+            lazy_bdecode(&tparams.resume_data[0], &tparams.resume_data[0] + tparams.resume_data.size(), rd, ec) == 0 &&
+            rd.type() == lazy_entry::dict_t ) {
+            lastActivity = rd.dict_find_int_value("last_download_time", 0);
+        }
+        torrentsToAdd.insert(std::make_pair(-lastActivity, tparams));
+    }
+
+    printf("queueing %zd user torrents\n", torrentsToAdd.size());
+    for( std::multimap<int64, add_torrent_params>::const_iterator it = torrentsToAdd.begin();
+         it != torrentsToAdd.end(); ++it ) {
+        LOCK(cs_twister);
+        if( m_userTorrent.count(it->second.name) || m_pendingTorrents.count(it->second.name) )
+            continue;
+        m_pendingTorrents.insert(it->second.name);
+        ses->async_add_torrent(it->second);
+    }
+}
+
 torrent_handle getTorrentUser(std::string const &username)
 {
     LOCK(cs_twister);
@@ -260,6 +327,84 @@ data_error:
     return -2;
 }
 
+// resume data is kept in the swarm db as ('r', username) => bencoded resume data
+void loadResumeData(std::map<std::string, std::vector<char> > &resumeData)
+{
+    leveldb::Iterator *pcursor = m_swarmDb->NewIterator();
+
+    CPlainDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('r', string());
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CSpanStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'r')
+                break;
+            string username;
+            ssKey >> username;
+
+            leveldb::Slice slValue = pcursor->value();
+            CSpanStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> resumeData[username];
+        } catch (std::exception &e) {
+            printf("loadResumeData: deserialize error\n");
+        }
+        pcursor->Next();
+    }
+    delete pcursor;
+}
+
+// memory budget hooks (see membudget.h)
+static size_t postCacheUsage()
+{
+    LOCK(cs_postCache);
+    return m_postCache ? m_postCache->size() * MEM_POST_SIZE : 0;
+}
+
+static void postCacheResize(size_t limit)
+{
+    LOCK(cs_postCache);
+    if( m_postCache ) {
+        m_postCache->setMaxSize(limit / MEM_POST_SIZE);
+    }
+}
+
+static size_t torrentCacheUsage()
+{
+    boost::shared_ptr<session> ses(m_ses);
+    return ses ? ses->get_cache_status().cache_size * MEM_TORRENT_BLOCK_SIZE : 0;
+}
+
+static void torrentCacheResize(size_t limit)
+{
+    boost::shared_ptr<session> ses(m_ses);
+    if( ses ) {
+        session_settings settings = ses->settings();
+        settings.cache_size = limit / MEM_TORRENT_BLOCK_SIZE;
+        ses->set_settings(settings);
+    }
+}
+
+static size_t dhtStorageUsage()
+{
+    boost::shared_ptr<session> ses(m_ses);
+    return ses ? ses->status().dht_storage_items * MEM_DHT_ITEM_SIZE : 0;
+}
+
+static void dhtStorageResize(size_t limit)
+{
+    boost::shared_ptr<session> ses(m_ses);
+    if( ses ) {
+        dht_settings dhts;
+        dhts.max_dht_items = limit / MEM_DHT_ITEM_SIZE;
+        ses->set_dht_settings(dhts);
+    }
+}
+
 void ThreadWaitExtIP()
 {
     SimpleThreadCounter threadCounter(&cs_twister, &m_threadsToJoin, "wait-extip");
@@ -284,7 +429,9 @@ void ThreadWaitExtIP()
     if (ec) {
         fprintf(stderr, "failed to create directory '%s': %s\n", swarmDbPath.string().c_str(), ec.message().c_str());
     }
-    m_swarmDb.reset(new CLevelDB(swarmDbPath.string(), 256*1024, false, false));
+    // posts are small bencoded dicts sharing most of their keys, they compress well
+    m_swarmDb.reset(new CLevelDB(swarmDbPath.string(), memoryBudget.GetLimit(MEM_SWARM_DB), false, false,
+                                 GetBoolArg("-swarmdbcompression", true)));
 
     int listen_port = GetListenPort() + LIBTORRENT_PORT_OFFSET;
     std::string bind_to_interface = "";
@@ -342,7 +489,9 @@ void ThreadWaitExtIP()
         // settings to test local connections
         //dhts.restrict_routing_ips = false;
         //dhts.restrict_search_ips = false;
+        dhts.max_dht_items = memoryBudget.GetLimit(MEM_DHT_STORAGE) / MEM_DHT_ITEM_SIZE;
         ses->set_dht_settings(dhts);
+        memoryBudget.Register(MEM_DHT_STORAGE, &dhtStorageUsage, &dhtStorageResize);
         
         if( !DhtProxy::fEnabled ) {
             ses->start_dht();
@@ -363,9 +512,16 @@ void ThreadWaitExtIP()
         settings.anonymous_mode = true;
         settings.force_proxy = true; // DHT won't work
     }
-    // disable read cache => there is still some bug due to twister piece size changes
-    settings.use_read_cache = false;
-    settings.cache_size = 0;
+    // read cache (in 16KiB blocks, one per post)
+    settings.use_read_cache = true;
+    if( mapArgs.count("-torrentcachesize") ) {
+        settings.cache_size = GetArg("-torrentcachesize", 16) * 64;
+        memoryBudget.SetLimit(MEM_TORRENT_CACHE, settings.cache_size * MEM_TORRENT_BLOCK_SIZE);
+        memoryBudget.Register(MEM_TORRENT_CACHE, &torrentCacheUsage);
+    } else {
+        settings.cache_size = memoryBudget.GetLimit(MEM_TORRENT_CACHE) / MEM_TORRENT_BLOCK_SIZE;
+        memoryBudget.Register(MEM_TORRENT_CACHE, &torrentCacheUsage, &torrentCacheResize);
+    }
 
     // more connections. less memory per connection.
     settings.connections_limit = 800;
@@ -388,20 +544,17 @@ void ThreadWaitExtIP()
 
     printf("libtorrent + dht started\n");
 
-    // wait up to 10 seconds for dht nodes to be set
-    for( int i = 0; i < 10; i++ ) {
-        MilliSleep(1000);
-        session_status ss = ses->status();
-        if( ss.dht_nodes )
-            break;
-    }
-
+    // user data and torrents don't need dht nodes, they are started right
+    // away so RPC doesn't wait for the dht bootstrap below
     boost::filesystem::path globalDataPath = GetDataDir() / GLOBAL_DATA_FILE;
     loadGlobalData(globalDataPath.string());
 
     std::set<std::string> torrentsToStart;
     {
         LOCK(cs_twister);
+        loadResumeData(m_resumeData);
+        printf("loaded resume data for %zd torrents\n", m_resumeData.size());
+
         boost::filesystem::path userDataPath = GetDataDir() / USER_DATA_FILE;
         loadUserData(userDataPath.string(), m_users);
         printf("loaded user_data for %zd users\n", m_users.size());
@@ -417,8 +570,23 @@ void ThreadWaitExtIP()
 
     }
     // now restart the user torrents
-    BOOST_FOREACH(string username, torrentsToStart) {
-        startTorrentUser(username, true);
+    startTorrentUsers(torrentsToStart);
+
+    // wait up to 10 seconds for dht nodes to be set
+    for( int i = 0; i < 10; i++ ) {
+        MilliSleep(1000);
+        session_status ss = ses->status();
+        if( ss.dht_nodes )
+            break;
+    }
+
+    // announces made before the dht had nodes reached nobody
+    {
+        LOCK(cs_twister);
+        std::map<std::string, torrent_handle>::iterator it;
+        for( it = m_userTorrent.begin(); it != m_userTorrent.end(); ++it ) {
+            it->second.force_dht_announce();
+        }
     }
 }
 
@@ -497,64 +665,89 @@ int getDhtNodes(boost::int64_t *dht_global_nodes)
     return dhtNodes;
 }
 
-void torrentManualTrackerUpdate(const std::string &username)
+static void addTrackerPeers(entry const &e)
 {
-    printf("torrentManualTrackerUpdate: updating torrent '%s'\n", 
-            username.c_str());
-    
-    Array params;
-    params.push_back(username);
-    params.push_back("tracker");
-    params.push_back("m");
-    Array res = dhtget(params, false).get_array();
-    if( !res.size() ) {
-        printf("torrentManualTrackerUpdate: no tracker response for torrent '%s'\n", 
-                username.c_str());
-    } else {
-        torrent_handle h = getTorrentUser(username);
-        for( size_t i = 0; i < res.size(); i++ ) {
-            if( res.at(i).type() != obj_type )
-                continue;
-            Object resDict = res.at(i).get_obj();
-
-            BOOST_FOREACH(const Pair& item, resDict) {
-                if( item.name_ == "p" && item.value_.type() == obj_type ) {
-                    Object pDict = item.value_.get_obj();
-                    BOOST_FOREACH(const Pair& pitem, pDict) {
-                        if( pitem.name_ == "v" && pitem.value_.type() == obj_type ) {
-                            Object vDict = pitem.value_.get_obj();
-                            BOOST_FOREACH(const Pair& vitem, vDict) {
-                                if( vitem.name_ == "values" && vitem.value_.type() == array_type ) {
-                                    Array values = vitem.value_.get_array();
-                                    printf("torrentManualTrackerUpdate: tracker for '%s' returned %zd values\n", 
-                                           username.c_str(), values.size());
-                                    for( size_t j = 0; j < values.size(); j++ ) {
-                                        if( values.at(j).type() != str_type )
-                                            continue;
-                                        size_t inSize = values.at(j).get_str().size();
-                                        char const* in = values.at(j).get_str().data();
-                                        tcp::endpoint ep;
-                                        if( inSize == 6 ) {
-                                            ep = libtorrent::detail::read_v4_endpoint<tcp::endpoint>(in);
-                                        }
+    entry const *p = e.find_key("p");
+    if( !p || p->type() != entry::dictionary_t )
+        return;
+    entry const *target = p->find_key("target");
+    entry const *v = p->find_key("v");
+    if( !target || target->type() != entry::dictionary_t ||
+        !v || v->type() != entry::dictionary_t )
+        return;
+    entry const *n = target->find_key("n");
+    entry const *values = v->find_key("values");
+    if( !n || n->type() != entry::string_t ||
+        !values || values->type() != entry::list_t )
+        return;
+
+    std::string const &username = n->string();
+    printf("torrentManualTrackerUpdate: tracker for '%s' returned %zd values\n",
+           username.c_str(), values->list().size());
+
+    torrent_handle h = getTorrentUser(username);
+    if( !h.is_valid() )
+        return;
+
+    for( entry::list_type::const_iterator it = values->list().begin(); it != values->list().end(); ++it ) {
+        if( it->type() != entry::string_t )
+            continue;
+        size_t inSize = it->string().size();
+        char const* in = it->string().data();
+        tcp::endpoint ep;
+        if( inSize == 6 ) {
+            ep = libtorrent::detail::read_v4_endpoint<tcp::endpoint>(in);
+        }
 #if TORRENT_USE_IPV6
-                                        else if ( inSize == 18 ) {
-                                            ep = libtorrent::detail::read_v6_endpoint<tcp::endpoint>(in);
-                                        }
+        else if ( inSize == 18 ) {
+            ep = libtorrent::detail::read_v6_endpoint<tcp::endpoint>(in);
+        }
 #endif
-                                        else {
-                                            continue;
-                                        }
-                                        h.connect_peer(ep);
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
+        else {
+            continue;
+        }
+        h.connect_peer(ep);
+    }
+}
+
+// ask dht proxies for the trackers of all these torrents in a single batch
+void torrentManualTrackerUpdate(const std::list<std::string> &usernames)
+{
+    if( !usernames.size() )
+        return;
+
+    alert_manager am(10 + 4 * usernames.size(), alert::dht_notification);
+    std::vector<CDHTTarget> vTargets;
+    std::vector<sha1_hash> vTargetHashes;
+
+    BOOST_FOREACH(const std::string &username, usernames) {
+        printf("torrentManualTrackerUpdate: updating torrent '%s'\n",
+                username.c_str());
+        vTargets.push_back(CDHTTarget(username, "tracker", true));
+        vTargetHashes.push_back(dhtTargetHash(username, "tracker", "m"));
+        DhtProxy::dhtgetMapAdd(vTargetHashes.back(), &am);
+    }
+
+    vector<CNode*> dhtProxyNodes = DhtProxy::dhtgetStartRequest(vTargets);
+
+    // wait for the first reply, then keep collecting while replies arrive
+    time_duration timeToWait = seconds(10);
+    while( am.wait_for_alert(timeToWait) && !m_shuttingDownSession ) {
+        std::auto_ptr<alert> a(am.get());
+
+        dht_reply_data_alert const* rd = alert_cast<dht_reply_data_alert>(&(*a));
+        if( rd ) {
+            BOOST_FOREACH(entry const &e, rd->m_lst) {
+                addTrackerPeers(e);
             }
         }
+        timeToWait = milliseconds(500);
+    }
+
+    BOOST_FOREACH(sha1_hash &ih, vTargetHashes) {
+        DhtProxy::dhtgetMapRemove(ih, &am);
     }
+    DhtProxy::dhtgetStopRequest(dhtProxyNodes, vTargets);
 }
 
 void ThreadMaintainDHTNodes()
@@ -674,6 +867,7 @@ void ThreadMaintainDHTNodes()
                 }
             }
             
+            list<string> torrentsToUpdate;
             BOOST_FOREACH(const std::string &username, activeTorrents) {
                 if( m_shuttingDownSession )
                     break;
@@ -682,10 +876,11 @@ void ThreadMaintainDHTNodes()
                     torrent_status status = h.status();
                     if( status.state == torrent_status::downloading &&
                         status.connect_candidates < 5 ) {
-                        torrentManualTrackerUpdate(username);
+                        torrentsToUpdate.push_back(username);
                     }
                 }
             }
+            torrentManualTrackerUpdate(torrentsToUpdate);
             lastManualTrackerUpdate = GetTime();
         }
 
@@ -719,6 +914,10 @@ void ThreadSessionAlerts()
         std::deque<alert*> alerts;
         ses->pop_alerts(&alerts);
         std::string now = time_now_string();
+
+        // resume data of all alerts in this round is written at once
+        CLevelDBBatch resumeBatch;
+        int resumeDataInBatch = 0;
         for (std::deque<alert*>::iterator i = alerts.begin()
                 , end(alerts.end()); i != end; ++i)
         {
@@ -743,6 +942,16 @@ void ThreadSessionAlerts()
                                     sha1_hash ih = dhtTargetHash(n->string(), r->string(), t->string());
                                     dhtgetMapPost(ih,*rd);
                                     DhtProxy::dhtgetPeerReqReply(ih,rd);
+
+                                    // wake up a dormant torrent if its user has posted something new
+                                    entry const *seq = p->find_key("seq");
+                                    if( r->string() == "status" && seq && seq->type() == entry::int_t &&
+                                        seq->integer() > torrentLastHave(n->string()) ) {
+                                        torrent_handle h = getTorrentUser(n->string());
+                                        if( h.is_valid() ) {
+                                            h.wake_up();
+                                        }
+                                    }
                                 }
                             }
                         }
@@ -820,9 +1029,9 @@ void ThreadSessionAlerts()
                            dd->m_is_neighbor, dd->m_got_data);
 #endif
                     sha1_hash ih = dhtTargetHash(dd->m_username, dd->m_resource, dd->m_multi ? "m" : "s");
+                    // lookup completed: post alert to return from wait_for_alert in dhtget()
+                    dhtgetMapPost(ih,*dd);
                     if( !dd->m_got_data ) {
-                        // no data: post alert to return from wait_for_alert in dhtget()
-                        dhtgetMapPost(ih,*dd);
                         DhtProxy::dhtgetPeerReqReply(ih,dd);
                     }
 
@@ -846,23 +1055,66 @@ void ThreadSessionAlerts()
                     continue;
                 }
 
+                add_torrent_alert const* ata = alert_cast<add_torrent_alert>(*i);
+                if (ata) {
+                    std::string const &username = ata->params.name;
+                    LOCK(cs_twister);
+                    if( m_pendingTorrents.erase(username) ) {
+                        // queued by startTorrentUsers: all of them are followed. it may
+                        // have been added by startTorrentUser meanwhile (as a neighbor,
+                        // not followed), in which case ata->error is duplicate_torrent.
+                        torrent_handle h;
+                        if( m_userTorrent.count(username) ) {
+                            h = m_userTorrent[username];
+                        } else if( !ata->error ) {
+                            h = ata->handle;
+                            m_userTorrent[username] = h;
+                            h.force_dht_announce();
+                        }
+                        if( h.is_valid() ) {
+                            h.set_following(true);
+                            h.auto_managed(false);
+                            h.resume();
+                        } else {
+                            printf("failed to add torrent for [%s,tracker]: %s\n",
+                                   username.c_str(), ata->error.message().c_str());
+                        }
+                    }
+                    continue;
+                }
+
                 save_resume_data_alert const* rda = alert_cast<save_resume_data_alert>(*i);
                 if (rda) {
-                    num_outstanding_resume_data--;
+                    resumeDataInBatch++;
                     if (!rda->resume_data) continue;
 
                     torrent_handle h = rda->handle;
-                    torrent_status st = h.status(torrent_handle::query_save_path);
+                    torrent_status st = h.status(torrent_handle::query_name);
                     std::vector<char> out;
                     bencode(std::back_inserter(out), *rda->resume_data);
-                    save_file(combine_path(st.save_path, to_hex(st.info_hash.to_string()) + ".resume"), out);
+                    resumeBatch.Write(make_pair('r', st.name), out);
                 }
 
                 if (alert_cast<save_resume_data_failed_alert>(*i))
                 {
-                    --num_outstanding_resume_data;
+                    resumeDataInBatch++;
+                }
+
+                piece_dropped_alert const* pd = alert_cast<piece_dropped_alert>(*i);
+                if (pd) {
+                    // piece was removed from the torrent: decoded copy is stale
+                    std::string username = pd->handle.status(torrent_handle::query_name).name;
+                    LOCK(cs_postCache);
+                    if( m_postCache ) {
+                        m_postCache->erase(username, pd->piece_index);
+                    }
                 }
         }
+
+        if( resumeDataInBatch ) {
+            m_swarmDb->WriteBatch(resumeBatch);
+            num_outstanding_resume_data -= resumeDataInBatch;
+        }
     }
 }
 
@@ -910,6 +1162,22 @@ void startSessionTorrent(boost::thread_group& threadGroup)
     
     DhtProxy::fEnabled = GetBoolArg("-dhtproxy", false);
 
+    if( mapArgs.count("-postcachesize") ) {
+        size_t postCacheSize = GetArg("-postcachesize", 10000);
+        {
+            LOCK(cs_postCache);
+            m_postCache.reset(new PostCache(postCacheSize));
+        }
+        memoryBudget.SetLimit(MEM_POST_CACHE, postCacheSize * MEM_POST_SIZE);
+        memoryBudget.Register(MEM_POST_CACHE, &postCacheUsage);
+    } else {
+        {
+            LOCK(cs_postCache);
+            m_postCache.reset(new PostCache(memoryBudget.GetLimit(MEM_POST_CACHE) / MEM_POST_SIZE));
+        }
+        memoryBudget.Register(MEM_POST_CACHE, &postCacheUsage, &postCacheResize);
+    }
+
     m_threadsToJoin = 0;
     threadGroup.create_thread(boost::bind(&ThreadWaitExtIP));
     threadGroup.create_thread(boost::bind(&ThreadMaintainDHTNodes));
@@ -1015,9 +1283,14 @@ std::string createSignature(std::string const &strMessage, std::string const &st
 
 bool getUserPubKey(std::string const &strUsername, CPubKey &pubkey, int maxHeight)
 {
+    if( pubKeyCache.Get(strUsername, maxHeight, pubkey) )
+        return true;
+
+    unsigned int nGeneration = pubKeyCache.GetGeneration();
     CTransaction txOut;
     uint256 hashBlock;
-    if( !GetTransaction(strUsername, txOut, hashBlock, maxHeight) ) {
+    int nHeight;
+    if( !GetTransaction(strUsername, txOut, hashBlock, maxHeight, &nHeight) ) {
         //printf("getUserPubKey: user unknown '%s'\n", strUsername.c_str());
         return false;
     }
@@ -1032,6 +1305,9 @@ bool getUserPubKey(std::string const &strUsername, CPubKey &pubkey, int maxHeigh
         printf("getUserPubKey: invalid pubkey for user '%s'\n", strUsername.c_str());
         return false;
     }
+    // only the newest key of a user is cached
+    if( maxHeight < 0 || maxHeight >= nBestHeight )
+        pubKeyCache.Set(strUsername, nHeight, pubkey, nGeneration);
     return true;
 }
 
@@ -1715,7 +1991,9 @@ Value dhtget(const Array& params, bool fHelp)
     if (fHelp || params.size() < 3 || params.size() > 6)
         throw runtime_error(
             "dhtget <username> <resource> <s(ingle)/m(ulti)> [timeout_ms] [timeout_multi_ms] [min_multi]\n"
-            "Get resource from dht network");
+            "Get resource from dht network\n"
+            "timeout_multi_ms and min_multi only apply when using dht proxy: a local\n"
+            "lookup returns as soon as the dht reports it complete.");
 
     boost::shared_ptr<session> ses(m_ses);
     if( !ses )
@@ -1753,6 +2031,10 @@ Value dhtget(const Array& params, bool fHelp)
     Array ret;
     std::set<std::string> uniqueSigPs;
 
+    // the local dht tells us when the lookup is complete (replies agree or
+    // traversal finished), so just wait for that within the overall timeout.
+    // dht proxy replies come in no particular order and have no such signal.
+    ptime deadline = time_now() + timeToWait;
     int repliesReceived = 0;
     while( am.wait_for_alert(timeToWait) ) {
         std::auto_ptr<alert> a(am.get());
@@ -1785,7 +2067,11 @@ Value dhtget(const Array& params, bool fHelp)
             break;
         }
 
-        if( repliesReceived++ < minMultiReplies ) {
+        if( !DhtProxy::fEnabled ) {
+            timeToWait = deadline - time_now();
+            if( timeToWait <= seconds(0) )
+                break;
+        } else if( repliesReceived++ < minMultiReplies ) {
             timeToWait = timeToWaitMulti;
             //printf("dhtget: wait again repliesReceived=%d lastSeq=%d\n", repliesReceived, lastSeq);
         } else {
@@ -2084,6 +2370,39 @@ Value newrtmsg(const Array& params, bool fHelp)
     return entryToJson(v);
 }
 
+static bool getCachedPost(std::string const &username, int k, entry &v)
+{
+    LOCK(cs_postCache);
+    return m_postCache && m_postCache->get(username, k, v);
+}
+
+static bool hasCachedPost(std::string const &username, int k)
+{
+    LOCK(cs_postCache);
+    return m_postCache && m_postCache->contains(username, k);
+}
+
+static void cachePost(std::string const &username, int k, entry const &v)
+{
+    if( k < 0 )
+        return;
+    LOCK(cs_postCache);
+    if( m_postCache ) {
+        m_postCache->put(username, k, v);
+    }
+}
+
+static int64 cachedPostTime(entry const &v)
+{
+    entry const *userpost = v.find_key("userpost");
+    if( !userpost || userpost->type() != entry::dictionary_t )
+        return -1;
+    entry const *time = userpost->find_key("time");
+    if( !time || time->type() != entry::int_t )
+        return -1;
+    return time->integer();
+}
+
 Value getposts(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -2112,26 +2431,48 @@ Value getposts(const Array& params, bool fHelp)
 
         torrent_handle h = getTorrentUser(strUsername);
         if( h.is_valid() ){
-            std::vector<std::string> pieces;
-            h.get_pieces(pieces, count, max_id, since_id, flags);
-
-            BOOST_FOREACH(string const& piece, pieces) {
-                lazy_entry v;
-                int pos;
-                libtorrent::error_code ec;
-                if (lazy_bdecode(piece.data(), piece.data()+piece.size(), v, ec, &pos) == 0 &&
-                    v.type() == lazy_entry::dict_t) {
-                    lazy_entry const* post = v.dict_find_dict("userpost");
-                    int64 time = post->dict_find_int_value("time",-1);
-                    
-                    if(time == -1 || time > GetAdjustedTime() + MAX_TIME_IN_FUTURE ) {
-                        printf("getposts: ignoring far-future message by '%s'\n", strUsername.c_str());
-                    }
+            std::vector<int> ids;
+            h.get_piece_ids(ids, count, max_id, since_id, flags);
+
+            // ids are in descending order. serve hits from the post cache and
+            // read each run of consecutive misses with a single get_pieces.
+            for( size_t i = 0; i < ids.size(); ) {
+                entry vEntry;
+                if( getCachedPost(strUsername, ids[i], vEntry) ) {
+                    postsByTime.insert( pair<int64,entry>(cachedPostTime(vEntry), vEntry) );
+                    i++;
+                    continue;
+                }
 
-                    entry vEntry;
-                    vEntry = v;
-                    hexcapePost(vEntry);
-                    postsByTime.insert( pair<int64,entry>(time, vEntry) );
+                size_t j = i + 1;
+                while( j < ids.size() && !hasCachedPost(strUsername, ids[j]) )
+                    j++;
+
+                std::vector<std::string> pieces;
+                h.get_pieces(pieces, j - i, ids[i], ids[j-1] - 1, flags);
+                i = j;
+
+                BOOST_FOREACH(string const& piece, pieces) {
+                    lazy_entry v;
+                    int pos;
+                    libtorrent::error_code ec;
+                    if (lazy_bdecode(piece.data(), piece.data()+piece.size(), v, ec, &pos) == 0 &&
+                        v.type() == lazy_entry::dict_t) {
+                        lazy_entry const* post = v.dict_find_dict("userpost");
+                        if( !post )
+                            continue;
+                        int64 time = post->dict_find_int_value("time",-1);
+
+                        if(time == -1 || time > GetAdjustedTime() + MAX_TIME_IN_FUTURE ) {
+                            LogPrint("twister", "getposts: ignoring far-future message by '%s'\n", strUsername.c_str());
+                        }
+
+                        entry vEntry;
+                        vEntry = v;
+                        hexcapePost(vEntry);
+                        cachePost(strUsername, post->dict_find_int_value("k",-1), vEntry);
+                        postsByTime.insert( pair<int64,entry>(time, vEntry) );
+                    }
                 }
             }
         }
@@ -2250,11 +2591,21 @@ Value getmentions(const Array& params, bool fHelp)
                     int64 time = ptime->integer();
 
                     if(time <= 0 || time > GetAdjustedTime() + MAX_TIME_IN_FUTURE ) {
-                        printf("getmentions: ignoring far-future post\n");
+                        LogPrint("twister", "getmentions: ignoring far-future post\n");
                     } else {
+                        const entry *n = post->find_key("n");
+                        const entry *k = post->find_key("k");
+                        bool cacheable = n && n->type() == entry::string_t &&
+                                         k && k->type() == entry::int_t;
+
                         entry vEntry;
-                        vEntry = mentions.at(i);
-                        hexcapePost(vEntry);
+                        if( !cacheable || !getCachedPost(n->string(), k->integer(), vEntry) ) {
+                            vEntry = mentions.at(i);
+                            hexcapePost(vEntry);
+                            if( cacheable ) {
+                                cachePost(n->string(), k->integer(), vEntry);
+                            }
+                        }
                         vEntry["id"] = i;
                         ret.push_back(entryToJson(vEntry));
                     }
@@ -2430,31 +2781,28 @@ Value listusernamespartial(const Array& params, bool fHelp)
     if( params.size() > 2 )
         exact_match       = params[2].get_bool();
 
-    set<string> retStrings;
-
-    // priorize users in following list
+    // priorize users followed by our local users
+    std::map<std::string,int> mapFollowers;
     {
         LOCK(pwalletMain->cs_wallet);
         BOOST_FOREACH(const PAIRTYPE(CKeyID, CKeyMetadata)& item, pwalletMain->mapKeyMetadata) {
             LOCK(cs_twister);
             BOOST_FOREACH(const string &user, m_users[item.second.username].m_following) {
-                if( (exact_match && userStartsWith.size() != user.size()) ||
-                    userStartsWith.size() > user.size() ) {
-                    continue;
-                }
-                int toCompare = userStartsWith.size();
-                if( memcmp( user.data(), userStartsWith.data(), toCompare ) == 0 )
-                    retStrings.insert( user );
-                if( retStrings.size() >= count )
-                    break;
+                mapFollowers[user]++;
             }
         }
     }
 
-    pblocktree->GetNamesFromPartial(userStartsWith, retStrings, count);
+    std::vector<std::string> usernames;
+    if( exact_match ) {
+        if( usernameIndex.Exists(userStartsWith) )
+            usernames.push_back(userStartsWith);
+    } else {
+        usernameIndex.GetNamesFromPartial(userStartsWith, usernames, count, &mapFollowers);
+    }
 
     Array ret;
-    BOOST_FOREACH(string username, retStrings) {
+    BOOST_FOREACH(string username, usernames) {
         ret.push_back(username);
     }
 
@@ -2594,6 +2942,7 @@ Value torrentstatus(const Array& params, bool fHelp)
     result.push_back(Pair("state", status.state));
     result.push_back(Pair("paused", status.paused));
     result.push_back(Pair("auto_managed", status.auto_managed));
+    result.push_back(Pair("dormant", status.dormant));
     result.push_back(Pair("num_peers", status.num_peers));
     result.push_back(Pair("list_peers", status.list_peers));
     result.push_back(Pair("connect_candidates", status.connect_candidates));
@@ -2859,10 +3208,13 @@ Value search(const Array& params, bool fHelp)
                         int64 time = p->dict_find_int_value("time",-1);
 
                         entry vEntry;
-                        vEntry = *p;
-                        hexcapePost(vEntry);
+                        if( !getCachedPost(n, k, vEntry) ) {
+                            vEntry = v;
+                            hexcapePost(vEntry);
+                            cachePost(n, k, vEntry);
+                        }
 
-                        posts[pair<std::string,int>(n,k)] = pair<int64,entry>(time,vEntry);
+                        posts[pair<std::string,int>(n,k)] = pair<int64,entry>(time,vEntry["userpost"]);
                     }
                 }
             }
@@ -3005,22 +3357,14 @@ Value search(const Array& params, bool fHelp)
 
     } else if( scope == "users" ) {
         // search users (blockchain)
-        // @todo: there should be a faster way
         std::multimap<string::size_type,std::string> usernamesByLength;
 
         boost::algorithm::to_lower(keyword);
 
-        string allowed = "abcdefghijklmnopqrstuvwxyz0123456789_";
-        for( int i = 0; i < allowed.size(); ++i ) {
-            set<string> usernames;
-            string prefix(1, allowed[i]);
-            pblocktree->GetNamesFromPartial(prefix, usernames, std::numeric_limits<int>::max());
-
-            BOOST_FOREACH(string username, usernames) {
-                if( username.find(keyword) != string::npos ) {
-                    usernamesByLength.insert( pair<string::size_type,std::string>(username.size(), username) );
-                }
-            }
+        std::vector<std::string> usernames;
+        usernameIndex.GetNamesContaining(keyword, usernames);
+        BOOST_FOREACH(string username, usernames) {
+            usernamesByLength.insert( pair<string::size_type,std::string>(username.size(), username) );
         }
 
         std::multimap<string::size_type,std::string>::iterator it;
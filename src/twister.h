@@ -17,6 +17,7 @@
 
 namespace libtorrent {
     class entry;
+    struct torrent_handle;
 }
 
 class twister
@@ -28,11 +29,19 @@ public:
 void startSessionTorrent(boost::thread_group& threadGroup);
 void stopSessionTorrent();
 
+libtorrent::torrent_handle startTorrentUser(std::string const &username, bool following);
+libtorrent::torrent_handle getTorrentUser(std::string const &username);
+
 bool getUserPubKey(std::string const &strUsername, CPubKey &pubkey, int maxHeight = -1);
 std::string createSignature(std::string const &strMessage, CKeyID &keyID);
 std::string createSignature(std::string const &strMessage, std::string const &strUsername);
 bool verifySignature(std::string const &strMessage, std::string const &strUsername, std::string const &strSign, int maxHeight = -1);
 
+bool createSignedUserpost(libtorrent::entry &v, std::string const &username, int k,
+                          std::string const &msg,
+                          libtorrent::entry const *rt, libtorrent::entry const *sig_rt,
+                          libtorrent::entry const *dm,
+                          std::string const &reply_n, int reply_k);
 bool acceptSignedPost(char const *data, int data_size, std::string username, int seq, std::string &errmsg, boost::uint32_t *flags);
 bool validatePostNumberForUser(std::string const &username, int k);
 bool usernameExists(std::string const &username);
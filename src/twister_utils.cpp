@@ -402,4 +402,50 @@ sha1_hash dhtTargetHash(std::string const &username, std::string const &resource
     return hasher(buf.data(), buf.size()).final();
 }
 
+bool PostCache::get(std::string const &username, int k, libtorrent::entry &post)
+{
+    std::map<PostId, PostList::iterator>::iterator it = m_index.find(PostId(username,k));
+    if( it == m_index.end() )
+        return false;
+
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    post = it->second->second;
+    return true;
+}
+
+void PostCache::put(std::string const &username, int k, libtorrent::entry const &post)
+{
+    if( !m_maxSize )
+        return;
+
+    PostId id(username,k);
+    std::map<PostId, PostList::iterator>::iterator it = m_index.find(id);
+    if( it != m_index.end() ) {
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        it->second->second = post;
+        return;
+    }
+
+    m_lru.push_front(std::make_pair(id, post));
+    m_index[id] = m_lru.begin();
+
+    setMaxSize(m_maxSize);
+}
+
+void PostCache::setMaxSize(size_t maxSize)
+{
+    m_maxSize = maxSize;
+    while( m_index.size() > m_maxSize ) {
+        m_index.erase(m_lru.back().first);
+        m_lru.pop_back();
+    }
+}
 
+void PostCache::erase(std::string const &username, int k)
+{
+    std::map<PostId, PostList::iterator>::iterator it = m_index.find(PostId(username,k));
+    if( it != m_index.end() ) {
+        m_lru.erase(it->second);
+        m_index.erase(it);
+    }
+}
@@ -8,6 +8,8 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <list>
+#include <map>
 
 // in-memory unencrypted DMs
 struct StoredDirectMsg {
@@ -28,6 +30,31 @@ struct UserData {
     std::vector<libtorrent::entry> m_mentionsPosts;
 };
 
+// size-bounded LRU of decoded posts keyed by (username, k).
+// posts are stored hexcaped, ready to be served by getposts, search etc.
+// not thread safe: callers must hold their own lock.
+class PostCache
+{
+public:
+    typedef std::pair<std::string,int> PostId;
+
+    explicit PostCache(size_t maxSize) : m_maxSize(maxSize) {}
+
+    bool get(std::string const &username, int k, libtorrent::entry &post);
+    void put(std::string const &username, int k, libtorrent::entry const &post);
+    void erase(std::string const &username, int k);
+    bool contains(std::string const &username, int k) const { return m_index.count(PostId(username,k)); }
+    size_t size() const { return m_index.size(); }
+    void setMaxSize(size_t maxSize);
+
+private:
+    typedef std::list< std::pair<PostId, libtorrent::entry> > PostList;
+
+    size_t m_maxSize;
+    // most recently used first
+    PostList m_lru;
+    std::map<PostId, PostList::iterator> m_index;
+};
 
 class twister_utils
 {
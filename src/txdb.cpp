@@ -126,12 +126,12 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) {
         boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            CSpanStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
             if (chType == 'c') {
                 leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+                CSpanStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
                 CCoins coins;
                 ssValue >> coins;
                 uint256 txhash;
@@ -177,6 +177,77 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+void static BatchWriteUsernameRecords(CLevelDBBatch &batch, const std::map<std::string, std::vector<CUsernameRecord> > &mapUserRecords) {
+    for (std::map<std::string, std::vector<CUsernameRecord> >::const_iterator it=mapUserRecords.begin(); it!=mapUserRecords.end(); it++) {
+        if (it->second.empty())
+            batch.Erase(make_pair('u', it->first));
+        else
+            batch.Write(make_pair('u', it->first), it->second);
+    }
+}
+
+// names of a block may share prefixes, so their changes are merged before being batched
+void static BatchAddNamesToPartialNameTree(CBlockTreeDB &db, CLevelDBBatch &batch, const std::vector<std::string> &vNames) {
+    std::map<std::string, std::string> mapNextChars;
+    std::set<std::string> setChanged;
+    for (std::vector<std::string>::const_iterator it=vNames.begin(); it!=vNames.end(); it++) {
+        const std::string &name = *it;
+        for (size_t i=0; i<name.size(); i++) {
+            std::string partial = name.substr(0, i+1);
+            char ch = (i+1 < name.size()) ? name.at(i+1) : '.'; // '.' marks end of name
+            if (!mapNextChars.count(partial))
+                db.ReadPartialNameTree(partial, mapNextChars[partial]);
+            std::string &nextChars = mapNextChars[partial];
+            if (nextChars.find(ch) == string::npos) {
+                nextChars.push_back(ch);
+                setChanged.insert(partial);
+            }
+        }
+    }
+    for (std::set<std::string>::const_iterator it=setChanged.begin(); it!=setChanged.end(); it++)
+        batch.Write(std::make_pair('n', *it), mapNextChars[*it]);
+}
+
+// only the end of name marker goes away, the prefixes may be shared with other names
+void static BatchRemoveNamesFromPartialNameTree(CBlockTreeDB &db, CLevelDBBatch &batch, const std::vector<std::string> &vNames) {
+    for (std::vector<std::string>::const_iterator it=vNames.begin(); it!=vNames.end(); it++) {
+        std::string nextChars;
+        if (!db.ReadPartialNameTree(*it, nextChars))
+            continue;
+        size_t pos = nextChars.find('.');
+        if (pos == string::npos)
+            continue;
+        nextChars.erase(pos, 1);
+        if (nextChars.empty())
+            batch.Erase(std::make_pair('n', *it));
+        else
+            batch.Write(std::make_pair('n', *it), nextChars);
+    }
+}
+
+bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect,
+                                const std::map<std::string, std::vector<CUsernameRecord> > &mapUserRecords,
+                                const std::vector<std::string> &vNames) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(make_pair('t', it->first), it->second);
+    BatchWriteUsernameRecords(batch, mapUserRecords);
+    BatchAddNamesToPartialNameTree(*this, batch, vNames);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadUsernameRecords(const std::string &username, std::vector<CUsernameRecord> &records) {
+    return Read(make_pair('u', username), records);
+}
+
+bool CBlockTreeDB::WriteUsernameRecords(const std::map<std::string, std::vector<CUsernameRecord> > &mapUserRecords,
+                                        const std::vector<std::string> &vRemovedNames) {
+    CLevelDBBatch batch;
+    BatchWriteUsernameRecords(batch, mapUserRecords);
+    BatchRemoveNamesFromPartialNameTree(*this, batch, vRemovedNames);
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
 }
@@ -221,24 +292,48 @@ bool CBlockTreeDB::AddNameToPartialNameTree(const std::string &name) {
     return AddCharToPartialNameTree( name, '.' ); // mark end of name
 }
 
-void CBlockTreeDB::GetNamesFromPartial(const std::string &partial, std::set< std::string > &names, size_t count) {
-    std::string nextChars;
-    if (ReadPartialNameTree(partial, nextChars)) {
-        for(size_t i=0; i<nextChars.size() && names.size()<count; i++) {
-            if (nextChars.at(i) == '.') {
-                names.insert(partial);
-            } else {
-                GetNamesFromPartial(partial+nextChars.substr(i,1), names, count);
-            }
+bool CBlockTreeDB::LoadNames(std::vector<std::string> &names) {
+    leveldb::Iterator *pcursor = NewIterator();
+
+    CPlainDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('n', string());
+    pcursor->Seek(ssKeySet.str());
+
+    // a partial name whose next chars include '.' is a complete username
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CSpanStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'n')
+                break;
+            string partialName;
+            ssKey >> partialName;
+
+            leveldb::Slice slValue = pcursor->value();
+            CSpanStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            string nextChars;
+            ssValue >> nextChars;
+            if (nextChars.find('.') != string::npos)
+                names.push_back(partialName);
+
+            pcursor->Next();
+        } catch (std::exception &e) {
+            delete pcursor;
+            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
         }
     }
+    delete pcursor;
+    return true;
 }
 
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     leveldb::Iterator *pcursor = NewIterator();
 
-    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    CPlainDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
     ssKeySet << make_pair('b', uint256(0));
     pcursor->Seek(ssKeySet.str());
 
@@ -247,12 +342,12 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
         boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            CSpanStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
             if (chType == 'b') {
                 leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+                CSpanStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
                 CDiskBlockIndex diskindex;
                 ssValue >> diskindex;
 
@@ -293,3 +388,198 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 
     return true;
 }
+
+CUsernameIndex usernameIndex;
+
+void CUsernameIndex::Load(const std::vector<std::string> &names) {
+    LOCK(cs);
+    vNames = names;
+    sort(vNames.begin(), vNames.end());
+    vNames.erase(unique(vNames.begin(), vNames.end()), vNames.end());
+}
+
+void CUsernameIndex::Clear() {
+    LOCK(cs);
+    vNames.clear();
+}
+
+void CUsernameIndex::Add(const std::string &name) {
+    LOCK(cs);
+    std::vector<std::string>::iterator it = lower_bound(vNames.begin(), vNames.end(), name);
+    if (it == vNames.end() || *it != name)
+        vNames.insert(it, name);
+}
+
+void CUsernameIndex::Remove(const std::string &name) {
+    LOCK(cs);
+    std::vector<std::string>::iterator it = lower_bound(vNames.begin(), vNames.end(), name);
+    if (it != vNames.end() && *it == name)
+        vNames.erase(it);
+}
+
+bool CUsernameIndex::Exists(const std::string &name) const {
+    LOCK(cs);
+    return binary_search(vNames.begin(), vNames.end(), name);
+}
+
+size_t CUsernameIndex::Size() const {
+    LOCK(cs);
+    return vNames.size();
+}
+
+static bool CompareFollowers(const std::pair<int,std::string> &a, const std::pair<int,std::string> &b) {
+    return a.first > b.first;
+}
+
+void CUsernameIndex::GetNamesFromPartial(const std::string &partial, std::vector<std::string> &names, size_t count,
+                                         const std::map<std::string,int> *mapFollowers) const {
+    LOCK(cs);
+    // followed names first: only those need ranking, there are few of them
+    std::set<std::string> setRanked;
+    if (mapFollowers) {
+        std::vector<std::pair<int,std::string> > vRanked;
+        std::map<std::string,int>::const_iterator mi = mapFollowers->lower_bound(partial);
+        for (; mi != mapFollowers->end() && mi->first.compare(0, partial.size(), partial) == 0; ++mi) {
+            if (mi->second > 0 && binary_search(vNames.begin(), vNames.end(), mi->first))
+                vRanked.push_back(make_pair(mi->second, mi->first));
+        }
+        stable_sort(vRanked.begin(), vRanked.end(), CompareFollowers);
+        for (size_t i = 0; i < vRanked.size() && names.size() < count; i++) {
+            names.push_back(vRanked[i].second);
+            setRanked.insert(vRanked[i].second);
+        }
+    }
+
+    // then the rest, alphabetically
+    std::vector<std::string>::const_iterator it = lower_bound(vNames.begin(), vNames.end(), partial);
+    for (; it != vNames.end() && names.size() < count && it->compare(0, partial.size(), partial) == 0; ++it) {
+        if (!setRanked.count(*it))
+            names.push_back(*it);
+    }
+}
+
+void CUsernameIndex::GetNamesContaining(const std::string &keyword, std::vector<std::string> &names) const {
+    LOCK(cs);
+    BOOST_FOREACH(const std::string &name, vNames) {
+        if (name.find(keyword) != string::npos)
+            names.push_back(name);
+    }
+}
+
+CPubKeyCache pubKeyCache;
+
+static const int PUBKEYCACHE_VERSION = 1;
+
+bool CPubKeyCache::Get(const std::string &username, int maxHeight, CPubKey &pubkey) const {
+    LOCK(cs);
+    std::map<std::string, std::pair<int, CPubKey> >::const_iterator mi = mapPubKeys.find(username);
+    // an older key may be needed for heights below the newest one
+    if (mi == mapPubKeys.end() || (maxHeight >= 0 && mi->second.first > maxHeight))
+        return false;
+    pubkey = mi->second.second;
+    return true;
+}
+
+unsigned int CPubKeyCache::GetGeneration() const {
+    LOCK(cs);
+    return nGeneration;
+}
+
+void CPubKeyCache::Set(const std::string &username, int nHeight, const CPubKey &pubkey, unsigned int nGenerationIn) {
+    LOCK(cs);
+    if (nGenerationIn == nGeneration)
+        mapPubKeys[username] = make_pair(nHeight, pubkey);
+}
+
+void CPubKeyCache::Erase(const std::string &username) {
+    LOCK(cs);
+    mapPubKeys.erase(username);
+    nGeneration++;
+}
+
+void CPubKeyCache::Clear() {
+    LOCK(cs);
+    mapPubKeys.clear();
+    nGeneration++;
+}
+
+size_t CPubKeyCache::Size() const {
+    LOCK(cs);
+    return mapPubKeys.size();
+}
+
+bool CPubKeyCache::Write(const boost::filesystem::path &path, const uint256 &hashBlock) const {
+    // serialize, checksum data up to that point, then append csum
+    CPlainDataStream ssPubKeys(SER_DISK, CLIENT_VERSION);
+    ssPubKeys << FLATDATA(Params().MessageStart());
+    ssPubKeys << PUBKEYCACHE_VERSION << hashBlock;
+    {
+        LOCK(cs);
+        ssPubKeys << mapPubKeys;
+    }
+    uint256 hash = Hash(ssPubKeys.begin(), ssPubKeys.end());
+    ssPubKeys << hash;
+
+    boost::filesystem::path pathTmp = path.string() + ".new";
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!fileout)
+        return error("CPubKeyCache::Write() : open failed");
+    try {
+        fileout << ssPubKeys;
+    }
+    catch (std::exception &e) {
+        return error("CPubKeyCache::Write() : I/O error");
+    }
+    FileCommit(fileout);
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, path))
+        return error("CPubKeyCache::Write() : Rename-into-place failed");
+    return true;
+}
+
+bool CPubKeyCache::Read(const boost::filesystem::path &path, uint256 &hashBlock) {
+    FILE *file = fopen(path.string().c_str(), "rb");
+    CAutoFile filein = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return false;
+
+    int dataSize = GetFilesize(filein) - sizeof(uint256);
+    if (dataSize < 4)
+        return error("CPubKeyCache::Read() : file too short");
+    std::vector<char> vchData(dataSize);
+    uint256 hashIn;
+    try {
+        filein.read(&vchData[0], dataSize);
+        filein >> hashIn;
+    }
+    catch (std::exception &e) {
+        return error("CPubKeyCache::Read() : I/O error or stream data corrupted");
+    }
+    filein.fclose();
+
+    if (hashIn != Hash(vchData.begin(), vchData.end()))
+        return error("CPubKeyCache::Read() : checksum mismatch; data corrupted");
+
+    std::map<std::string, std::pair<int, CPubKey> > mapRead;
+    try {
+        CSpanStream ssPubKeys(&vchData[0], &vchData[0] + vchData.size(), SER_DISK, CLIENT_VERSION);
+        unsigned char pchMsgTmp[4];
+        int nVersion;
+        ssPubKeys >> FLATDATA(pchMsgTmp) >> nVersion;
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+            return error("CPubKeyCache::Read() : invalid network magic number");
+        if (nVersion != PUBKEYCACHE_VERSION)
+            return error("CPubKeyCache::Read() : unknown version %d", nVersion);
+        ssPubKeys >> hashBlock >> mapRead;
+    }
+    catch (std::exception &e) {
+        return error("CPubKeyCache::Read() : deserialize error");
+    }
+
+    LOCK(cs);
+    mapPubKeys.swap(mapRead);
+    nGeneration++;
+    return true;
+}
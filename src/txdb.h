@@ -27,6 +27,25 @@ public:
     bool GetStats(CCoinsStats &stats);
 };
 
+/** Username registration (or key replacement) as recorded in the main chain */
+class CUsernameRecord
+{
+public:
+    int nHeight;
+    uint256 hashBlock;
+    CTransaction tx;
+
+    CUsernameRecord() : nHeight(-1) {}
+    CUsernameRecord(int nHeightIn, const uint256 &hashBlockIn, const CTransaction &txIn) :
+        nHeight(nHeightIn), hashBlock(hashBlockIn), tx(txIn) {}
+
+    IMPLEMENT_SERIALIZE(
+        READWRITE(nHeight);
+        READWRITE(hashBlock);
+        READWRITE(tx);
+    )
+};
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDB
 {
@@ -49,14 +68,75 @@ public:
     bool HaveTxIndex(const uint256 &txid);
     bool EraseTxIndex(const uint256 &txid);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list,
+                      const std::map<std::string, std::vector<CUsernameRecord> > &mapUserRecords,
+                      const std::vector<std::string> &vNames);
+    bool ReadUsernameRecords(const std::string &username, std::vector<CUsernameRecord> &records);
+    bool WriteUsernameRecords(const std::map<std::string, std::vector<CUsernameRecord> > &mapUserRecords,
+                              const std::vector<std::string> &vRemovedNames);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool WritePartialNameTree(const std::string &partialName, const std::string &nextChars);
     bool ReadPartialNameTree(const std::string &partialName, std::string &nextChars);
     bool AddCharToPartialNameTree(const std::string &partialName, char ch);
     bool AddNameToPartialNameTree(const std::string &name);
-    void GetNamesFromPartial(const std::string &partial, std::set< std::string > &names, size_t count);
+    bool LoadNames(std::vector<std::string> &names);
     bool LoadBlockIndexGuts();
 };
 
+/** In-memory sorted list of registered usernames (mirrors the partial name tree) */
+class CUsernameIndex
+{
+private:
+    mutable CCriticalSection cs;
+    std::vector<std::string> vNames; // sorted
+
+public:
+    void Load(const std::vector<std::string> &names);
+    void Clear();
+    void Add(const std::string &name);
+    void Remove(const std::string &name);
+    bool Exists(const std::string &name) const;
+    size_t Size() const;
+
+    // up to count names starting with partial, alphabetically. names with
+    // more followers (if mapFollowers is given) come first.
+    void GetNamesFromPartial(const std::string &partial, std::vector<std::string> &names, size_t count,
+                             const std::map<std::string,int> *mapFollowers = NULL) const;
+    void GetNamesContaining(const std::string &keyword, std::vector<std::string> &names) const;
+};
+
+extern CUsernameIndex usernameIndex;
+
+/** Newest pubkey of the usernames looked up so far, with the height it is
+ *  valid from. Saved to pubkeys.dat on shutdown, so that the signature checks
+ *  done at startup don't each go back to the username registry. */
+class CPubKeyCache
+{
+private:
+    mutable CCriticalSection cs;
+    std::map<std::string, std::pair<int, CPubKey> > mapPubKeys;
+    // bumped by every Erase, see Set
+    unsigned int nGeneration;
+
+public:
+    CPubKeyCache() : nGeneration(0) {}
+
+    // pubkey of username for a signature made at maxHeight (-1: newest)
+    bool Get(const std::string &username, int maxHeight, CPubKey &pubkey) const;
+    unsigned int GetGeneration() const;
+    // nGenerationIn is the generation read before looking the key up: if a
+    // block touching any username got in since, the key may be stale.
+    void Set(const std::string &username, int nHeight, const CPubKey &pubkey, unsigned int nGenerationIn);
+    void Erase(const std::string &username);
+    void Clear();
+    size_t Size() const;
+
+    // the snapshot records the best block it matches
+    bool Write(const boost::filesystem::path &path, const uint256 &hashBlock) const;
+    bool Read(const boost::filesystem::path &path, uint256 &hashBlock);
+};
+
+extern CPubKeyCache pubKeyCache;
+
 #endif // BITCOIN_TXDB_LEVELDB_H
@@ -37,6 +37,7 @@ namespace boost {
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/thread.hpp>
 #include <openssl/crypto.h>
 #include <openssl/rand.h>
@@ -232,6 +233,24 @@ static boost::once_flag debugPrintInitFlag = BOOST_ONCE_INIT;
 static FILE* fileout = NULL;
 static boost::mutex* mutexDebugLog = NULL;
 
+// While ThreadLogWriter runs, lines are queued for it instead of being
+// written by the thread logging them: a slow disk then never holds up the
+// network or disk threads. Formatting is done before taking the lock, which
+// is only held to queue the line. Once the queue is full lines are dropped
+// (and counted) rather than waiting for the writer.
+static std::vector<std::string>* vLogQueue = NULL;
+static boost::condition_variable* condLogQueue = NULL;
+static size_t nLogQueueSize = 0;
+static unsigned int nLogDropped = 0;
+static bool fLogWriterRunning = false;
+static const size_t LOG_QUEUE_MAX_SIZE = 4 * 1024 * 1024;
+
+// Times each line (by hash of its text) was logged in the current minute,
+// see nLogRateLimit. cleared every minute, so it holds at most a minute of lines
+static std::map<size_t, int>* mapLogRate = NULL;
+static int64 nLogRateWindowStart = 0;
+int nLogRateLimit = 600;
+
 static void DebugPrintInit()
 {
     assert(fileout == NULL);
@@ -242,16 +261,49 @@ static void DebugPrintInit()
     if (fileout) setbuf(fileout, NULL); // unbuffered
 
     mutexDebugLog = new boost::mutex();
+    vLogQueue = new std::vector<std::string>();
+    condLogQueue = new boost::condition_variable();
+    mapLogRate = new std::map<size_t, int>();
 }
 
-int OutputDebugStringF(const char* pszFormat, ...)
+// reopen the log file, if requested. called by the thread writing to it
+static void ReopenDebugLogIfRequested()
+{
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
+            setbuf(fileout, NULL); // unbuffered
+    }
+}
+
+// false if str was already logged nLogRateLimit times this minute, fLast
+// for the last time it is accepted. only repeats of the very same text are
+// limited, lines that differ (progress lines and such) all go through.
+// called with mutexDebugLog held
+static bool LogRateAccept(const std::string& str, bool& fLast)
+{
+    fLast = false;
+    if (nLogRateLimit <= 0 || fDebug)
+        return true;
+    int64 nNow = GetTime();
+    if (nNow - nLogRateWindowStart >= 60) {
+        nLogRateWindowStart = nNow;
+        mapLogRate->clear();
+    }
+    int& nLines = (*mapLogRate)[boost::hash<std::string>()(str)];
+    fLast = (++nLines == nLogRateLimit);
+    return nLines <= nLogRateLimit;
+}
+
+static int LogPrintV(const char* pszFormat, va_list ap)
 {
     int ret = 0; // Returns total number of characters written
     if (fPrintToConsole)
     {
         // print to console
         va_list arg_ptr;
-        va_start(arg_ptr, pszFormat);
+        va_copy(arg_ptr, ap);
         ret += vprintf(pszFormat, arg_ptr);
         va_end(arg_ptr);
     }
@@ -263,28 +315,39 @@ int OutputDebugStringF(const char* pszFormat, ...)
         if (fileout == NULL)
             return ret;
 
+        va_list arg_ptr;
+        va_copy(arg_ptr, ap);
+        std::string str = vstrprintf(pszFormat, arg_ptr);
+        va_end(arg_ptr);
+
         boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
 
-        // reopen the log file, if requested
-        if (fReopenDebugLog) {
-            fReopenDebugLog = false;
-            boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-            if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
-                setbuf(fileout, NULL); // unbuffered
-        }
+        bool fLimitReached;
+        if (!LogRateAccept(str, fLimitReached))
+            return ret;
 
         // Debug print useful for profiling
+        std::string strLine;
         if (fLogTimestamps && fStartedNewLine)
-            ret += fprintf(fileout, "%s ", DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()).c_str());
-        if (pszFormat[strlen(pszFormat) - 1] == '\n')
-            fStartedNewLine = true;
-        else
-            fStartedNewLine = false;
-
-        va_list arg_ptr;
-        va_start(arg_ptr, pszFormat);
-        ret += vfprintf(fileout, pszFormat, arg_ptr);
-        va_end(arg_ptr);
+            strLine = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()) + " ";
+        fStartedNewLine = (pszFormat[strlen(pszFormat) - 1] == '\n');
+        strLine += str;
+        if (fLimitReached && fStartedNewLine)
+            strLine += "(more lines like this one are dropped for the next minute, see -logratelimit)\n";
+        ret += strLine.size();
+
+        if (fLogWriterRunning) {
+            if (nLogQueueSize + strLine.size() > LOG_QUEUE_MAX_SIZE) {
+                nLogDropped++;
+            } else {
+                nLogQueueSize += strLine.size();
+                vLogQueue->push_back(strLine);
+            }
+            condLogQueue->notify_one();
+        } else {
+            ReopenDebugLogIfRequested();
+            fwrite(strLine.data(), 1, strLine.size(), fileout);
+        }
     }
 
 #ifdef WIN32
@@ -298,7 +361,7 @@ int OutputDebugStringF(const char* pszFormat, ...)
             static std::string buffer;
 
             va_list arg_ptr;
-            va_start(arg_ptr, pszFormat);
+            va_copy(arg_ptr, ap);
             buffer += vstrprintf(pszFormat, arg_ptr);
             va_end(arg_ptr);
 
@@ -316,6 +379,93 @@ int OutputDebugStringF(const char* pszFormat, ...)
     return ret;
 }
 
+int OutputDebugStringF(const char* pszFormat, ...)
+{
+    va_list arg_ptr;
+    va_start(arg_ptr, pszFormat);
+    int ret = LogPrintV(pszFormat, arg_ptr);
+    va_end(arg_ptr);
+    return ret;
+}
+
+bool LogAcceptCategory(const char* category)
+{
+    // -debug alone (or -debug=1) enables all categories
+    if (fDebug)
+        return true;
+    // -debug=<category> only that one
+    static boost::thread_specific_ptr<set<string> > ptrCategory;
+    if (ptrCategory.get() == NULL)
+    {
+        ptrCategory.reset(new set<string>());
+        map<string, vector<string> >::const_iterator mi = mapMultiArgs.find("-debug");
+        if (mi != mapMultiArgs.end())
+            ptrCategory->insert(mi->second.begin(), mi->second.end());
+    }
+    return ptrCategory->count(string(category)) != 0;
+}
+
+int LogPrint(const char* category, const char* pszFormat, ...)
+{
+    // checked first, so that filtered out lines cost no formatting
+    if (!LogAcceptCategory(category))
+        return 0;
+    va_list arg_ptr;
+    va_start(arg_ptr, pszFormat);
+    int ret = LogPrintV(pszFormat, arg_ptr);
+    va_end(arg_ptr);
+    return ret;
+}
+
+void ThreadLogWriter()
+{
+    RenameThread("bitcoin-logwr");
+    if (fPrintToConsole || fPrintToDebugger)
+        return;
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    if (fileout == NULL)
+        return;
+
+    std::vector<std::string> vLines;
+    unsigned int nDropped = 0;
+    {
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        fLogWriterRunning = true;
+    }
+    try {
+        while (true) {
+            {
+                boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+                while (vLogQueue->empty() && !nLogDropped)
+                    condLogQueue->wait(scoped_lock);
+                vLines.swap(*vLogQueue);
+                nLogQueueSize = 0;
+                nDropped = nLogDropped;
+                nLogDropped = 0;
+            }
+
+            // only this thread writes to the file while it runs
+            ReopenDebugLogIfRequested();
+            std::string strBatch;
+            BOOST_FOREACH(const std::string& strLine, vLines)
+                strBatch += strLine;
+            if (nDropped)
+                strBatch += strprintf("(%u log lines dropped, debug.log writer could not keep up)\n", nDropped);
+            fwrite(strBatch.data(), 1, strBatch.size(), fileout);
+            vLines.clear();
+        }
+    } catch (boost::thread_interrupted) {
+        // write what is left, further lines are written by their threads again
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        BOOST_FOREACH(const std::string& strLine, *vLogQueue)
+            fwrite(strLine.data(), 1, strLine.size(), fileout);
+        vLogQueue->clear();
+        nLogQueueSize = 0;
+        fLogWriterRunning = false;
+        throw;
+    }
+}
+
 string vstrprintf(const char *format, va_list ap)
 {
     char buffer[50000];
@@ -146,10 +146,17 @@ extern std::string strMiscWarning;
 extern bool fNoListen;
 extern bool fLogTimestamps;
 extern volatile bool fReopenDebugLog;
+extern int nLogRateLimit;
 
 void RandAddSeed();
 void RandAddSeedPerfmon();
 int ATTR_WARN_PRINTF(1,2) OutputDebugStringF(const char* pszFormat, ...);
+/** Whether -debug enables log lines of this category */
+bool LogAcceptCategory(const char* category);
+/** Log only if category is enabled, without formatting the line otherwise */
+int ATTR_WARN_PRINTF(2,3) LogPrint(const char* category, const char* pszFormat, ...);
+/** Write queued log lines to debug.log, so that logging threads don't wait on disk */
+void ThreadLogWriter();
 
 /*
   Rationale for the real_strprintf / strprintf construction:
@@ -184,6 +184,8 @@ HEADERS +=  \
     src/scrypt.h \
     src/utf8core.h \
     src/dhtproxy.h \
+    src/membudget.h \
+    src/blockfilemap.h \
     src/twister.h \
     src/twister_rss.h \
     src/twister_utils.h
@@ -262,6 +264,8 @@ SOURCES += \ #src/qt/bitcoin.cpp \
     src/txdb.cpp \
     src/scrypt.cpp \
     src/dhtproxy.cpp \
+    src/membudget.cpp \
+    src/blockfilemap.cpp \
     src/twister.cpp \
     src/twister_rss.cpp \
     src/twister_utils.cpp